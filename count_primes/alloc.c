@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// We need _DEFAULT_SOURCE to pick up MAP_ANONYMOUS, MAP_HUGETLB, and
+// MADVISE().
+#define _DEFAULT_SOURCE
+
+#include "./alloc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+// Number of freed buffers the pool can hold.
+#define ALLOC_POOL_ENTRIES 32
+
+// Buffers freed by FREE_BUFFER() and kept for reuse: the first
+// NUM_POOLED entries of POOLED, of POOLED_BYTES[I] bytes each, which add
+// up to TOTAL_POOLED_BYTES, at most MAX_POOLED_BYTES.  POOL_LOCK guards
+// them all.
+static void *pooled[ALLOC_POOL_ENTRIES];
+static size_t pooled_bytes[ALLOC_POOL_ENTRIES];
+static int num_pooled = 0;
+static size_t total_pooled_bytes = 0;
+static size_t max_pooled_bytes = ALLOC_POOL_BYTES;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return BYTES rounded up to a whole number of huge pages.
+//
+//   BYTES -- The size to round.
+//
+static size_t round_to_huge_pages(size_t bytes) {
+  return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+}
+
+// Take a buffer of BYTES bytes out of the pool.  Returns the buffer, or
+// NULL if the pool holds none of that size.
+//
+//   BYTES -- The size of the buffer, in whole huge pages.
+//
+static void* take_pooled(size_t bytes) {
+  void *buffer = NULL;
+  pthread_mutex_lock(&pool_lock);
+  for (int i = 0; i < num_pooled; ++i) {
+    if (pooled_bytes[i] == bytes) {
+      buffer = pooled[i];
+      total_pooled_bytes -= bytes;
+      --num_pooled;
+      pooled[i] = pooled[num_pooled];
+      pooled_bytes[i] = pooled_bytes[num_pooled];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return buffer;
+}
+
+// Put BUFFER of BYTES bytes into the pool.  Returns false if the pool
+// has no room for it.
+//
+//   BUFFER -- The buffer to keep.
+//
+//   BYTES -- The size of the buffer, in whole huge pages.
+//
+static bool put_pooled(void *buffer, size_t bytes) {
+  bool kept = false;
+  pthread_mutex_lock(&pool_lock);
+  if (num_pooled < ALLOC_POOL_ENTRIES &&
+      total_pooled_bytes + bytes <= max_pooled_bytes) {
+    pooled[num_pooled] = buffer;
+    pooled_bytes[num_pooled] = bytes;
+    ++num_pooled;
+    total_pooled_bytes += bytes;
+    kept = true;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return kept;
+}
+
+// Map BYTES bytes of anonymous memory, backed by huge pages if
+// possible.  Returns the mapping, or NULL if it fails.
+//
+//   BYTES -- The size of the mapping, in whole huge pages.
+//
+static void* map_huge_pages(size_t bytes) {
+  void *buffer = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // This fails unless huge pages have been reserved.
+  buffer = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif  // MAP_HUGETLB
+  if (MAP_FAILED == buffer) {
+    buffer = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == buffer) {
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    // Merely a hint, so a failure leaves ordinary pages.
+    madvise(buffer, bytes, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+  }
+  return buffer;
+}
+
+void* alloc_buffer(size_t bytes) {
+  if (bytes < HUGE_PAGE_BYTES) {
+    void *buffer;
+    return 0 == posix_memalign(&buffer, BUFFER_ALIGNMENT,
+                               bytes > 0 ? bytes : 1) ? buffer : NULL;
+  }
+  bytes = round_to_huge_pages(bytes);
+  void *buffer = take_pooled(bytes);
+  return NULL != buffer ? buffer : map_huge_pages(bytes);
+}
+
+void free_buffer(void *buffer, size_t bytes) {
+  if (NULL == buffer) {
+    return;
+  }
+  if (bytes < HUGE_PAGE_BYTES) {
+    free(buffer);
+    return;
+  }
+  bytes = round_to_huge_pages(bytes);
+  if (!put_pooled(buffer, bytes)) {
+    munmap(buffer, bytes);
+  }
+}
+
+void limit_buffer_pool(size_t bytes) {
+  pthread_mutex_lock(&pool_lock);
+  max_pooled_bytes = bytes < ALLOC_POOL_BYTES ? bytes : ALLOC_POOL_BYTES;
+  while (total_pooled_bytes > max_pooled_bytes) {
+    --num_pooled;
+    munmap(pooled[num_pooled], pooled_bytes[num_pooled]);
+    total_pooled_bytes -= pooled_bytes[num_pooled];
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
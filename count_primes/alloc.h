@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files ALLOC.{H,C} declare and define ALLOC_BUFFER() and
+ * FREE_BUFFER(), which allocate the sieves and other large buffers of
+ * the sieve.
+ *
+ * Every buffer is aligned to a 64-byte cache line, so that no two
+ * threads share a line and whole lines can be loaded with vector
+ * instructions.  Buffers of at least HUGE_PAGE_BYTES are mapped
+ * directly and backed by huge pages where possible: first from the
+ * reserved pool of MAP_HUGETLB, and failing that with
+ * MADV_HUGEPAGE, which asks for transparent huge pages.  Either way a
+ * segment sieve the size of the L2 cache then takes one TLB entry
+ * rather than hundreds, and one page fault on first touch rather than
+ * hundreds.  Where neither is available, the buffer is mapped with
+ * ordinary pages.
+ *
+ * Pages are placed on the NUMA node of the thread that first touches
+ * them, so each worker allocates and fills its own buffers, which then
+ * stay local to it.
+ *
+ * Freed buffers of at least HUGE_PAGE_BYTES are kept in a small pool,
+ * of at most ALLOC_POOL_BYTES bytes in all, from which later requests
+ * of the same size are served, so that counting one interval after
+ * another does not map and unmap its segment sieves each time.  The
+ * pool is shared by all threads; a buffer taken from it keeps the
+ * placement of its first user.
+ *************************************************************************/
+
+#ifndef INCLUDED_ALLOC_DOT_H
+#define INCLUDED_ALLOC_DOT_H
+
+#include <stdlib.h>
+
+// The alignment of every buffer, the size of a cache line.
+#define BUFFER_ALIGNMENT 64
+
+// The size of a huge page, from which buffers are mapped directly.
+#define HUGE_PAGE_BYTES ((size_t) 2 << 20)
+
+// The largest number of bytes of freed buffers kept for reuse, unless
+// lowered by LIMIT_BUFFER_POOL().
+#define ALLOC_POOL_BYTES ((size_t) 64 << 20)
+
+// Allocate a buffer of BYTES bytes aligned to BUFFER_ALIGNMENT.
+// Returns a pointer to the buffer, or NULL if allocation fails.
+//
+//   BYTES -- The size of the buffer, which must be passed again to
+//     FREE_BUFFER().
+//
+void* alloc_buffer(size_t bytes);
+
+// Free BUFFER, allocated by ALLOC_BUFFER(), or keep it for reuse.
+//
+//   BUFFER -- The buffer to free, or NULL.
+//
+//   BYTES -- The size with which BUFFER was allocated.
+//
+void free_buffer(void *buffer, size_t bytes);
+
+// Keep at most BYTES bytes of freed buffers for reuse from now on, and
+// unmap those kept beyond that.  The limit applies to all threads.
+//
+//   BYTES -- The largest number of bytes to keep, at most
+//     ALLOC_POOL_BYTES.
+//
+void limit_buffer_pool(size_t bytes);
+
+#endif  // INCLUDED_ALLOC_DOT_H
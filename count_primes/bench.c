@@ -0,0 +1,274 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * BENCH.C is a benchmark harness for the stages of counting the primes
+ * in an interval.  For each interval of a matrix of starts (0, 2^32,
+ * 2^48, and near 2^63) and lengths (10^6 and 10^8), it sieves the
+ * interval with COUNT_PRIMES_IN_INTERVAL() in a single thread and
+ * reports the time of each stage of COUNT_PRIMES_STAGE_T, which the
+ * build of COUNT_PRIMES.C linked into this harness, compiled with
+ * COUNT_PRIMES_PROFILE, measures in its own workers:
+ *
+ * -) SMALL_PRIMES: listing the sieving primes up to the square root of
+ * the end of the interval.
+ *
+ * -) SEGMENT_INIT: filling each segment with the pattern of the primes
+ * 3 to 17.
+ *
+ * -) CROSS_SMALL, CROSS_MEDIUM, and CROSS_LARGE: crossing off the
+ * multiples of the primes 19 to 61, of the other primes up to the
+ * segment size, and of the larger primes through the buckets.
+ *
+ * -) COUNT: counting the primes left in each segment.
+ *
+ * -) END_TO_END: the whole COUNT_PRIMES_IN_INTERVAL() call, timed with
+ * FASTTIME.H.
+ *
+ * The sieve's count is checked against the count of the algorithm
+ * COUNT_PRIMES_IN_INTERVAL() picks by default.  Each interval is timed
+ * several times, and the median and 95th percentile of the times of
+ * each stage are printed as CSV, or as JSON with --json, to STDOUT, so
+ * that the results of different builds can be compared to track
+ * regressions.  NS_PER_NUMBER is the median divided by the length of
+ * the interval, so the stages add up to about the end-to-end time per
+ * integer.
+ *************************************************************************/
+
+#include <fasttime.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// COUNT_PRIMES.{H,C} declares and defines COUNT_PRIMES_IN_INTERVAL()
+// and, with COUNT_PRIMES_PROFILE defined as in the build linked here,
+// COUNT_PRIMES_TAKE_PROFILE().
+#define COUNT_PRIMES_PROFILE
+#include "./count_primes.h"
+// KERNELS.{H,C} declares and defines KERNELS_SELECT_ISA(), which the
+// "--isa" flag overrides the selected kernel variants with.
+#include "./kernels.h"
+
+// The starts of the benchmarked intervals.
+static const int64_t STARTS[] = {
+  0, (int64_t) 1 << 32, (int64_t) 1 << 48, INT64_MAX - ((int64_t) 1 << 32)
+};
+#define NUM_STARTS (sizeof(STARTS) / sizeof(STARTS[0]))
+
+// The lengths of the benchmarked intervals.
+static const int64_t LENGTHS[] = { 1000000, 100000000 };
+#define NUM_LENGTHS (sizeof(LENGTHS) / sizeof(LENGTHS[0]))
+
+// The default number of times each interval is timed.
+#define DEFAULT_REPS 5
+
+// The reported stages: those of COUNT_PRIMES_STAGE_T, followed by the
+// whole call.
+#define STAGE_END_TO_END COUNT_PRIMES_NUM_STAGES
+#define NUM_STAGES (COUNT_PRIMES_NUM_STAGES + 1)
+
+// Name of each stage in the output.
+static const char *STAGE_NAMES[NUM_STAGES] = {
+  "small_primes", "segment_init", "cross_small", "cross_medium",
+  "cross_large", "count", "end_to_end"
+};
+
+// Settings parsed from the command line.
+typedef struct options_t {
+  // The number of times each interval is timed.
+  int reps;
+  // Whether to print JSON rather than CSV.
+  bool json;
+} options_t;
+
+/**************************************************************************
+ * Helper methods
+ *************************************************************************/
+
+// Print the usage for this program.
+//
+//   PROGRAM_NAME -- the name of this executable.
+//
+static void print_usage(const char *program_name) {
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr,
+          "%s [--reps <n>] [--json] [--segment-bytes <bytes>]\n"
+          "\t[--isa generic|popcnt|avx2|avx512]\n", program_name);
+  fprintf(stderr,
+          "\tTime the stages of counting the primes in intervals starting\n"
+          "\tat 0, 2^{32}, 2^{48}, and near 2^{63}, and print the median and\n"
+          "\t95th percentile time of each as CSV.\n");
+  fprintf(stderr,
+          "\t--reps <n>: Time each interval <n> times (default %d).\n",
+          DEFAULT_REPS);
+  fprintf(stderr, "\t--json: Print JSON instead of CSV.\n");
+  fprintf(stderr,
+          "\t--segment-bytes <bytes>: Sieve segments of <bytes> bytes of\n"
+          "\t\tbitmap (default: the L2 cache size).\n");
+  fprintf(stderr,
+          "\t--isa generic|popcnt|avx2|avx512: Use the kernel variants for\n"
+          "\t\tthe given instruction set.\n");
+}
+
+// Helper function of MAIN() to parse the command-line arguments.
+//
+//   OPTIONS -- Pointer to storage for the parsed settings.
+//
+//   ARGC, ARGV -- Command-line arguments originally passed to MAIN.
+//
+static void parse_arguments(options_t *options, int argc, char *argv[]) {
+  options->reps = DEFAULT_REPS;
+  options->json = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      options->json = true;
+    } else if (strcmp(argv[i], "--reps") == 0) {
+      ++i;
+      if (argc == i || atoi(argv[i]) < 1) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->reps = atoi(argv[i]);
+    } else if (strcmp(argv[i], "--segment-bytes") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      count_primes_set_segment_bytes(atol(argv[i]));
+    } else if (strcmp(argv[i], "--isa") == 0) {
+      ++i;
+      if (argc == i || !kernels_select_isa(argv[i])) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+    } else {
+      print_usage(argv[0]);
+      exit(1);
+    }
+  }
+}
+
+// Compare the doubles at A and B for QSORT().
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// Sort the REPS times of each stage in SAMPLES, where SAMPLES[S *
+// REPS + R] is the time of stage S in repetition R, in nanoseconds,
+// and print their median and 95th percentile for the interval [START,
+// START+LENGTH).  FIRST is true for the first interval printed.
+static void print_results(const options_t *options, int64_t start,
+                          int64_t length, double *samples, bool first) {
+  int reps = options->reps;
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    double *times = samples + s * reps;
+    qsort(times, reps, sizeof(double), compare_doubles);
+    double median = reps % 2 == 1 ? times[reps / 2]
+        : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+    // The smallest time that at least 95% of the times do not exceed.
+    double p95 = times[(95 * reps + 99) / 100 - 1];
+    if (options->json) {
+      printf("%s{\"stage\": \"%s\", \"start\": %"PRId64
+             ", \"length\": %"PRId64", \"reps\": %d, \"median_ns\": %.0f"
+             ", \"p95_ns\": %.0f, \"ns_per_number\": %.6f}",
+             first && 0 == s ? "" : ",\n  ", STAGE_NAMES[s], start, length,
+             reps, median, p95, median / length);
+    } else {
+      printf("%s,%"PRId64",%"PRId64",%d,%.0f,%.0f,%.6f\n", STAGE_NAMES[s],
+             start, length, reps, median, p95, median / length);
+    }
+  }
+  fflush(stdout);
+}
+
+/**************************************************************************
+ * Main
+ *************************************************************************/
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  parse_arguments(&options, argc, argv);
+
+  int reps = options.reps;
+  double *samples = (double*) malloc(NUM_STAGES * reps * sizeof(double));
+  if (NULL == samples) {
+    fprintf(stderr, "Failed to allocate %d samples.\nAborting.\n", reps);
+    exit(1);
+  }
+
+  if (options.json) {
+    printf("[\n  ");
+  } else {
+    printf("stage,start,length,reps,median_ns,p95_ns,ns_per_number\n");
+  }
+  bool first = true;
+  for (size_t i = 0; i < NUM_STARTS; ++i) {
+    for (size_t j = 0; j < NUM_LENGTHS; ++j) {
+      int64_t start = STARTS[i];
+      int64_t length = LENGTHS[j];
+      if (length > INT64_MAX - start) {
+        length = INT64_MAX - start;
+      }
+      fprintf(stderr, "Timing [%"PRId64", %"PRId64")\n", start,
+              start + length);
+
+      // Find the count to check the sieve against with the default
+      // algorithm, then sieve every time.
+      count_primes_set_algorithm(COUNT_PRIMES_AUTO);
+      int64_t expected = count_primes_in_interval(start, length);
+      count_primes_set_algorithm(COUNT_PRIMES_SIEVE);
+
+      for (int r = 0; r < reps; ++r) {
+        double seconds[NUM_STAGES];
+        count_primes_take_profile(seconds);
+        fasttime_t begin = gettime();
+        int64_t num_primes = count_primes_in_interval(start, length);
+        fasttime_t end = gettime();
+        count_primes_take_profile(seconds);
+        seconds[STAGE_END_TO_END] = tdiff(begin, end);
+        if (num_primes != expected) {
+          fprintf(stderr, "The sieve found %"PRId64" primes in [%"PRId64
+                  ", %"PRId64") instead of %"PRId64".\nAborting.\n",
+                  num_primes, start, start + length, expected);
+          exit(1);
+        }
+        for (int s = 0; s < NUM_STAGES; ++s) {
+          samples[s * reps + r] = seconds[s] * 1e9;
+        }
+      }
+      print_results(&options, start, length, samples, first);
+      first = false;
+    }
+  }
+  if (options.json) {
+    printf("\n]\n");
+  }
+
+  free(samples);
+  return 0;
+}
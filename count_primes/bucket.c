@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include "./bucket.h"
+
+#include <stdio.h>
+
+bucket_sieve_t* create_bucket_sieve(int64_t num_buckets) {
+  bucket_sieve_t *buckets = (bucket_sieve_t*) malloc(sizeof(bucket_sieve_t));
+  if (NULL == buckets) {
+    return NULL;
+  }
+  buckets->buckets =
+      (bucket_block_t**) calloc(num_buckets, sizeof(bucket_block_t*));
+  if (NULL == buckets->buckets) {
+    free(buckets);
+    return NULL;
+  }
+  buckets->num_buckets = num_buckets;
+  buckets->capacity = num_buckets;
+  buckets->free_blocks = NULL;
+  return buckets;
+}
+
+// Free every block in the list BLOCKS.
+//
+//   BLOCKS -- A list of blocks linked through their NEXT fields.
+//
+static void free_blocks(bucket_block_t *blocks) {
+  while (NULL != blocks) {
+    bucket_block_t *next = blocks->next;
+    free(blocks);
+    blocks = next;
+  }
+}
+
+void destroy_bucket_sieve(bucket_sieve_t *buckets) {
+  for (int64_t i = 0; i < buckets->num_buckets; ++i) {
+    free_blocks(buckets->buckets[i]);
+  }
+  free_blocks(buckets->free_blocks);
+  free(buckets->buckets);
+  free(buckets);
+}
+
+bool reset_bucket_sieve(bucket_sieve_t *buckets, int64_t num_buckets) {
+  if (num_buckets > buckets->capacity) {
+    bucket_block_t **ring =
+        (bucket_block_t**) calloc(num_buckets, sizeof(bucket_block_t*));
+    if (NULL == ring) {
+      return false;
+    }
+    free(buckets->buckets);
+    buckets->buckets = ring;
+    buckets->capacity = num_buckets;
+  }
+  buckets->num_buckets = num_buckets;
+  return true;
+}
+
+void trim_bucket_sieve(bucket_sieve_t *buckets, int64_t max_free_blocks) {
+  bucket_block_t **link = &buckets->free_blocks;
+  for (int64_t i = 0; i < max_free_blocks && NULL != *link; ++i) {
+    link = &(*link)->next;
+  }
+  free_blocks(*link);
+  *link = NULL;
+}
+
+bucket_block_t* bucket_alloc_block(bucket_sieve_t *buckets) {
+  bucket_block_t *block = buckets->free_blocks;
+  if (NULL != block) {
+    buckets->free_blocks = block->next;
+  } else {
+    block = (bucket_block_t*) malloc(sizeof(bucket_block_t));
+    if (NULL == block) {
+      fprintf(stderr, "Failed to allocate a bucket block.\n"\
+              "This can happen if there is insufficient physical memory on the system.\n"\
+              "Aborting.\n");
+      exit(1);
+    }
+  }
+  block->next = NULL;
+  block->count = 0;
+  return block;
+}
+
+void bucket_release(bucket_sieve_t *buckets, bucket_block_t *blocks) {
+  while (NULL != blocks) {
+    bucket_block_t *next = blocks->next;
+    blocks->next = buckets->free_blocks;
+    buckets->free_blocks = blocks;
+    blocks = next;
+  }
+}
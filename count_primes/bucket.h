@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files BUCKET.{H,C} declare and define the BUCKET_SIEVE_T data
+ * type, which files the large sieving primes of a segmented sieve by
+ * the segment in which their next multiple falls, following the bucket
+ * sieve of Oliveira e Silva.
+ *
+ * A sieving prime P is _large_ if it exceeds the number of entries
+ * SEGMENT_ENTRIES of a segment, so that P has at most one multiple to
+ * mark in any segment and usually none.  Looping over every large
+ * prime in every segment would therefore cost far more than the
+ * crossing off itself.  Instead, a BUCKET_SIEVE_T keeps a ring of
+ * buckets, one per upcoming segment.  Each large prime lives in
+ * exactly one bucket, as a SIEVING_PRIME_T whose OFFSET locates its
+ * next multiple within that bucket's segment.  Sieving segment K then
+ * only touches the primes in bucket K: each one marks its multiple and
+ * is refiled into the bucket of the segment containing its following
+ * multiple.  Because consecutive odd multiples of P are P entries
+ * apart, a prime is never filed more than P/SEGMENT_ENTRIES + 1
+ * segments ahead, which bounds the size of the ring.
+ *
+ * Buckets are singly linked lists of fixed-size BUCKET_BLOCK_T blocks.
+ * Emptied blocks go on a free list and are reused, so that blocks are
+ * only allocated while the number of filed primes grows.
+ *************************************************************************/
+
+#ifndef INCLUDED_BUCKET_DOT_H
+#define INCLUDED_BUCKET_DOT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "./sieve.h"
+
+// Number of sieving primes held by one BUCKET_BLOCK_T.
+#define BUCKET_BLOCK_ENTRIES 1024
+
+// A block of sieving primes within a bucket.
+typedef struct bucket_block_t {
+  struct bucket_block_t *next;
+  int64_t count;
+  sieving_prime_t entries[BUCKET_BLOCK_ENTRIES];
+} bucket_block_t;
+
+// A ring of NUM_BUCKETS buckets.  BUCKETS[I] points to the block of
+// bucket I being filled, which links to the bucket's full blocks.
+// BUCKETS has room for CAPACITY buckets.
+typedef struct bucket_sieve_t {
+  int64_t num_buckets;
+  int64_t capacity;
+  bucket_block_t **buckets;
+  bucket_block_t *free_blocks;
+} bucket_sieve_t;
+
+// Create a BUCKET_SIEVE_T with NUM_BUCKETS empty buckets.  Returns a
+// pointer to the newly created BUCKET_SIEVE_T, or NULL if allocation
+// fails.
+//
+//   NUM_BUCKETS -- The number of buckets in the ring.
+//
+bucket_sieve_t* create_bucket_sieve(int64_t num_buckets);
+
+// Free the BUCKET_SIEVE_T structure and all of its blocks.
+//
+//   BUCKETS -- the BUCKET_SIEVE_T structure to free.
+//
+void destroy_bucket_sieve(bucket_sieve_t *buckets);
+
+// Make BUCKETS a ring of NUM_BUCKETS buckets, keeping its free blocks
+// for reuse, so that one BUCKET_SIEVE_T can serve many sieves in turn.
+// Every bucket must be empty.  Returns false if allocation fails, in
+// which case BUCKETS is unchanged.
+//
+//   BUCKETS -- The BUCKET_SIEVE_T to reuse.
+//
+//   NUM_BUCKETS -- The new number of buckets in the ring.
+//
+bool reset_bucket_sieve(bucket_sieve_t *buckets, int64_t num_buckets);
+
+// Free all but MAX_FREE_BLOCKS of the free blocks of BUCKETS.
+//
+//   BUCKETS -- The target BUCKET_SIEVE_T.
+//
+//   MAX_FREE_BLOCKS -- The number of free blocks to keep.
+//
+void trim_bucket_sieve(bucket_sieve_t *buckets, int64_t max_free_blocks);
+
+// Return an empty block, taken from the free list of BUCKETS or newly
+// allocated.  Aborts if allocation fails.
+//
+//   BUCKETS -- The BUCKET_SIEVE_T that will own the block.
+//
+bucket_block_t* bucket_alloc_block(bucket_sieve_t *buckets);
+
+// Return the blocks in the list BLOCKS to the free list of BUCKETS.
+//
+//   BUCKETS -- The BUCKET_SIEVE_T that owns the blocks.
+//
+//   BLOCKS -- A list of blocks taken with BUCKET_TAKE().
+//
+void bucket_release(bucket_sieve_t *buckets, bucket_block_t *blocks);
+
+// File the sieving prime PRIME, whose next multiple is at index OFFSET
+// of a segment, into bucket BUCKET.
+//
+//   BUCKETS -- The target BUCKET_SIEVE_T.
+//
+//   BUCKET -- The bucket index, in [0, BUCKETS->NUM_BUCKETS).
+//
+//   PRIME -- The sieving prime.
+//
+//   OFFSET -- The index of the next multiple of PRIME in the segment
+//     of bucket BUCKET.
+//
+static inline void bucket_push(bucket_sieve_t *buckets, int64_t bucket,
+                               uint32_t prime, uint32_t offset) {
+  bucket_block_t *block = buckets->buckets[bucket];
+  if (NULL == block || BUCKET_BLOCK_ENTRIES == block->count) {
+    bucket_block_t *fresh = bucket_alloc_block(buckets);
+    fresh->next = block;
+    buckets->buckets[bucket] = block = fresh;
+  }
+  block->entries[block->count].prime = prime;
+  block->entries[block->count].offset = offset;
+  ++block->count;
+}
+
+// Detach and return the list of blocks in bucket BUCKET, leaving the
+// bucket empty.  The caller returns the blocks with BUCKET_RELEASE()
+// once it has processed them.
+//
+//   BUCKETS -- The target BUCKET_SIEVE_T.
+//
+//   BUCKET -- The bucket index, in [0, BUCKETS->NUM_BUCKETS).
+//
+static inline bucket_block_t* bucket_take(bucket_sieve_t *buckets,
+                                          int64_t bucket) {
+  bucket_block_t *blocks = buckets->buckets[bucket];
+  buckets->buckets[bucket] = NULL;
+  return blocks;
+}
+
+#endif  // INCLUDED_BUCKET_DOT_H
@@ -44,44 +44,86 @@
  * COUNT_PRIMES_IN_INTERVAL() method, suppose that
  * COUNT_PRIMES_IN_INTERVAL() is invoked to find all primes in an
  * interval [START, START+LENGTH) of nonnegative numbers less than
- * 2^63.  The MAX_SIEVE_LENGTH constant stores the maximum size of a
- * sieve that COUNT_PRIMES_IN_INTERVAL() will allocate, and for
- * didactic simplicity, let us assume that LENGTH >= MAX_SIEVE_LENGTH
- * > \sqrt{h}.
+ * 2^63.  The SEGMENT_LENGTH of the sieve that
+ * COUNT_PRIMES_IN_INTERVAL() allocates is chosen so that the sieve
+ * fits in the L2 cache (see COUNT_PRIMES_SET_SEGMENT_BYTES()), and
+ * for didactic simplicity, let us assume that LENGTH >=
+ * SEGMENT_LENGTH.
  *
- * -) First, COUNT_PRIMES_IN_INTERVAL() calls the FIND_SMALL_PRIMES()
- * helper, which executes a basic prime sieve algorithm to find all
- * primes in [0, 1.42 * 2^31).  The resulting SMALL_PRIMES sieve
- * countains all of the primes needed to sieve [START, START+LENGTH),
- * because any composite value in [START, START+LENGTH) where
- * START+LENGTH < 2^63 is divisible by some prime in [0,
- * \sqrt{START+LENGTH}) \subset [0, 1.42 * 2^31).
+ * -) First, COUNT_PRIMES_IN_INTERVAL() calls CREATE_PRIME_LIST(),
+ * which executes a small segmented sieve on wheel-30 segments to find
+ * all odd primes P with P^2 < START+LENGTH and packs them into the
+ * SIEVING_PRIMES list (see PRIME_LIST.H), one byte per prime.
+ * These are all of the primes needed to sieve [START, START+LENGTH),
+ * because any odd composite value in [START, START+LENGTH) is
+ * divisible by some odd prime P with P^2 < START+LENGTH.
  *
- * -) Next, COUNT_PRIMES_IN_INTERVAL() calls the
- * COUNT_PRIMES_IN_INTERVAL_HELPER() method to sieve the interval
- * [START, START+MAX_SIEVE_LENGTH) as follows.
+ * -) Next, COUNT_PRIMES_IN_INTERVAL() walks SIEVING_PRIMES once and
+ * collects the primes up to SEGMENT_ENTRIES into an array of
+ * SIEVING_PRIME_T, which pairs each sieving prime with the offset of
+ * its next multiple relative to the current segment.  Larger primes
+ * are read from SIEVING_PRIMES as they are needed and filed into
+ * buckets (see BUCKET.H).
  *
- * --) To sieve [START, START+MAX_SIEVE_LENGTH),
- * COUNT_PRIMES_IN_INTERVAL_HELPER() first creates the LARGE_PRIMES
- * sieve to represent [START, START+MAX_SIEVE_LENGTH), i.e., a sieve
- * of length MAX_SIEVE_LENGTH whose Ith entry ultimately records the
- * primality of I+START.
+ * -) COUNT_PRIMES_IN_INTERVAL() then calls the
+ * COUNT_PRIMES_IN_INTERVAL_HELPER() method to sieve the segment
+ * [START, START+SEGMENT_LENGTH) as follows.
  *
- * --) COUNT_PRIMES_IN_INTERVAL_HELPER() then considers each prime P
- * in SMALL_PRIMES and markes each multiple of P in [START,
- * START+MAX_SIEVE_LENGTH) that is larger than P and smaller than
- * START+MAX_SIEVE_LENGTH as composite.  Once all primes in
- * SMALL_PRIMES have been evaluated, all sieve entries representing
- * composite values in [START, START+MAX_SIEVE_LENGTH) have been
- * marked as composite.
+ * --) COUNT_PRIMES_IN_INTERVAL_HELPER() initializes the LARGE_PRIMES
+ * sieve to represent the odd integers in [START,
+ * START+SEGMENT_LENGTH), i.e., an odd-only sieve whose Ith entry
+ * ultimately records the primality of the Ith odd integer in the
+ * segment.  The only even prime, 2, is accounted for separately.
  *
- * --) COUNT_PRIMES_IN_INTERVAL_HELPER() then scans LARGE_PRIMES to
- * count the number of primes in [START, START+MAX_SIEVE_LENGTH) and
- * returns this count to COUNT_PRIMES_IN_INTERVAL().
+ * --) COUNT_PRIMES_IN_INTERVAL_HELPER() then considers each sieving
+ * prime P and marks each odd multiple of P in the segment, starting
+ * from the stored offset, as composite.  The offset of the first
+ * multiple beyond the segment is stored back, so that START % P is
+ * computed only once per prime rather than once per prime per
+ * segment.  A prime enters the array of active sieving primes at the
+ * first segment containing P^2, since smaller multiples of P have a
+ * smaller prime factor.
+ *
+ * --) COUNT_PRIMES_IN_INTERVAL_HELPER() then counts the entries of
+ * LARGE_PRIMES still marked as prime with POPCOUNT_WORDS(), a word at
+ * a time, and returns this count of the primes in [START,
+ * START+SEGMENT_LENGTH) to COUNT_PRIMES_IN_INTERVAL().  Crossing off
+ * therefore clears entries unconditionally, without first testing
+ * whether each one is already composite.
  *
  * -) COUNT_PRIMES_IN_INTERVAL() then updates START and LENGTH to
  * evaluate the next unevaluated segment of [START, START+LENGTH) of
- * length at most MAX_SIEVE_LENGTH and repeats the process.
+ * length at most SEGMENT_LENGTH and repeats the process.
+ *
+ * COUNT_PRIMES_IN_INTERVAL_PARALLEL() extends this scheme to multiple
+ * worker threads.  The SIEVING_PRIMES list is built once and shared,
+ * read-only, by all workers.  The interval [START, START+LENGTH) is
+ * then split into NUM_THREADS contiguous ranges of nearly equal
+ * length, and each worker thread allocates its own LARGE_PRIMES sieve
+ * and sieving-prime offsets and runs the segment loop described
+ * above over its own range.  The per-range counts are summed once all
+ * workers have finished.
+ *
+ * All of this is carried out by COUNT_PRIMES_IN_INTERVAL_CTX() on a
+ * COUNT_PRIMES_CTX_T, which keeps the sieves, offsets, and buckets of
+ * its workers, and the sieving primes, from one query to the next.
+ * COUNT_PRIMES_IN_INTERVAL() and COUNT_PRIMES_IN_INTERVAL_PARALLEL()
+ * just count with a context created for the call.
+ *
+ * Sieving takes time proportional to LENGTH, so for long intervals
+ * COUNT_PRIMES_IN_INTERVAL_PARALLEL() instead computes \pi(START+LENGTH-1)
+ * - \pi(START-1) with LMO_PI(), whose running time grows only as
+ * (START+LENGTH)^{2/3}.  See COUNT_PRIMES_SET_ALGORITHM() and LMO.H.
+ *
+ * Once a table of \pi(x) at regular checkpoints has been loaded with
+ * COUNT_PRIMES_OPEN_PI_TABLE(), COUNT_PRIMES_IN_INTERVAL_CTX() looks up
+ * the count of the checkpoint-aligned middle of the interval, and only
+ * counts the partial blocks at its ends.  See PI_TABLE.H.
+ *
+ * Conversely, listing the sieving primes takes time proportional to
+ * \sqrt{START+LENGTH} however short the interval is, so very short
+ * intervals are counted by testing each integer with
+ * MILLER_RABIN_PRIME_P() instead.
  *
  * These methods use the SIEVE_T data type defined in SIEVE.H, which
  * implements a sieve data structure.  See the documentation in
@@ -89,167 +131,1372 @@
  *************************************************************************/
 
 /**************************************************************************
- * WARNING: This code can allocate nearly 4GB of memory at once.
+ * WARNING: This code can allocate about 150MB of memory for the list
+ * of sieving primes, plus 8 bytes per sieving prime (about 1.2GB near
+ * 2^63) for each worker thread.
  * Errors might occur if this code is run on a machine with
  * insufficient memory.
  *************************************************************************/
 
+// We need _POSIX_C_SOURCE to pick up SYSCONF() and the pthreads API.
+#define _POSIX_C_SOURCE 200809L
+
 #include "./count_primes.h"
 
+#include <fasttime.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #ifndef NDEBUG
 #define NDEBUG
 #endif  // NDEBUG
 #include <tbassert.h>
 
-#include "./sieve.h"
+#include "./alloc.h"
+#include "./bucket.h"
+#include "./kernels.h"
+#include "./lmo.h"
+#include "./pi_table.h"
+#include "./prime_list.h"
 #include "./trialdiv.h"
+#include "./sieve.h"
+
+// Segment size, in bytes of sieve bitmap, used when the L2 cache size
+// cannot be detected.
+const int64_t DEFAULT_SEGMENT_BYTES = (int64_t)1 << 18;
+
+// Largest allowed segment size, in bytes of sieve bitmap.  Limiting
+// segments to 2^30 entries lets the offsets in SIEVING_PRIME_T and
+// WHEEL_PRIME_T be stored in 32 bits: a step along the wheel can leave
+// the next multiple of a medium prime up to 3 times the prime, and so
+// 3 segments, past the end of the segment.
+const int64_t MAX_SEGMENT_BYTES = (int64_t)1 << 27;
+
+// Smallest segment size, in bytes of sieve bitmap, to which the
+// memory budget of a COUNT_PRIMES_CTX_T can shrink segments.
+const int64_t MIN_SEGMENT_BYTES = (int64_t)1 << 12;
+
+// Listing the sieving primes up to \sqrt{N} takes about as long as
+// testing \sqrt{N}/MILLER_RABIN_CROSSOVER integers with
+// MILLER_RABIN_PRIME_P().
+const int64_t MILLER_RABIN_CROSSOVER = 64;
+
+// Segment size, in bytes of sieve bitmap, requested through
+// COUNT_PRIMES_SET_SEGMENT_BYTES().  Zero selects the L2 cache size.
+static int64_t segment_bytes = 0;
+
+// Algorithm requested through COUNT_PRIMES_SET_ALGORITHM().
+static count_primes_algorithm_t algorithm = COUNT_PRIMES_AUTO;
+
+// A list of sieving primes and the number of calls sieving with it.
+typedef struct shared_primes_t {
+  prime_list_t *list;
+  int64_t users;
+} shared_primes_t;
+
+// Sieving primes shared among calls, loaded by
+// COUNT_PRIMES_OPEN_CACHE() or kept from an earlier call after
+// COUNT_PRIMES_RESERVE(), or NULL.  A list that is replaced while in
+// use is freed by its last user.  SHARED_PRIMES_LOCK guards
+// SHARED_PRIMES and the USERS of every SHARED_PRIMES_T.
+static shared_primes_t *shared_primes = NULL;
+static pthread_mutex_t shared_primes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// High endpoint passed to COUNT_PRIMES_RESERVE(), or 0.
+static int64_t reserved_end = 0;
+
+// Table of \pi(x) loaded by COUNT_PRIMES_OPEN_PI_TABLE(), or NULL.
+static pi_table_t *pi_table = NULL;
+
+// Seconds of counting between two checkpoints of
+// COUNT_PRIMES_IN_INTERVAL_RESUMABLE().
+#define CHECKPOINT_SECONDS 10.0
+
+// Identifies a state file written by
+// COUNT_PRIMES_IN_INTERVAL_RESUMABLE(), and the version of its layout.
+#define CHECKPOINT_MAGIC "CPSTATE1"
+
+// Contents of a state file of COUNT_PRIMES_IN_INTERVAL_RESUMABLE(): of
+// the interval [START, START+LENGTH), the first DONE integers hold
+// COUNT primes.
+typedef struct checkpoint_t {
+  char magic[8];
+  int64_t start;
+  int64_t length;
+  int64_t done;
+  int64_t count;
+} checkpoint_t;
+
+// The odd primes crossed off every segment by copying PRESIEVE_PATTERN
+// rather than one multiple at a time.  Together they account for most
+// of the entries crossed off in a segment.
+static const int64_t PRESIEVE_PRIMES[] = { 3, 5, 7, 11, 13, 17 };
+#define NUM_PRESIEVE_PRIMES 6
+#define PRESIEVE_MAX_PRIME 17
+
+// The period of PRESIEVE_PATTERN in odd-only entries, the product of
+// PRESIEVE_PRIMES.
+#define PRESIEVE_PERIOD (3 * 5 * 7 * 11 * 13 * 17)
+
+// Odd-only sieve of one period of the odd integers with the multiples
+// of PRESIEVE_PRIMES crossed off: bit M is set if 2M+1 is coprime to
+// all of them.  It is followed by another 128 bits of the next period,
+// so that any 64 bits starting within the first period can be read
+// without wrapping around.  Built once by BUILD_PRESIEVE_PATTERN().
+#define PRESIEVE_WORDS ((PRESIEVE_PERIOD + 128) / 64 + 1)
+static uint64_t presieve_pattern[PRESIEVE_WORDS];
+static pthread_once_t presieve_once = PTHREAD_ONCE_INIT;
+
+// The sieving primes P < 64 above PRESIEVE_MAX_PRIME, whose multiples
+// are crossed off a word at a time by STAMP_SMALL_PRIMES().  P hits
+// every word at least once, so this takes fewer stores than crossing
+// off each multiple.
+static const int64_t STAMP_PRIMES[] = {
+  19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61
+};
+#define NUM_STAMP_PRIMES 11
+#define STAMP_MAX_PRIME 61
+
+// STAMP_MASKS[I][R] has the bits R, R+P, R+2P, ... < 64 set, where P =
+// STAMP_PRIMES[I] and R < P.  Built once by BUILD_PRESIEVE_PATTERN().
+static uint64_t stamp_masks[NUM_STAMP_PRIMES][64];
+
+#ifdef COUNT_PRIMES_PROFILE
+// Seconds spent in each COUNT_PRIMES_STAGE_T since the last call to
+// COUNT_PRIMES_TAKE_PROFILE(), guarded by PROFILE_LOCK.
+static double profile_seconds[COUNT_PRIMES_NUM_STAGES];
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Start timing a stage at the variable LAP.
+#define PROFILE_START(lap) fasttime_t lap = gettime()
+
+// Add the time since LAP to stage STAGE of the array PROFILE, and
+// restart LAP.
+#define PROFILE_LAP(lap, profile, stage)                        \
+  do {                                                          \
+    fasttime_t now = gettime();                                 \
+    (profile)[stage] += tdiff(lap, now);                        \
+    lap = now;                                                  \
+  } while (0)
+#else
+#define PROFILE_START(lap)
+#define PROFILE_LAP(lap, profile, stage)
+#endif  // COUNT_PRIMES_PROFILE
+
+// Number of primes a PRIME_SINK_T collects before passing them on.
+// Small enough for the primes to stay in the L1 cache.
+#define PRIME_SINK_ENTRIES 2048
 
-// Maximum length of an interval represented by a SIEVE data
-// structure.  Limiting MAX_SIEVE_LENGTH to 2^30 ensures that this program
-// allocates at most ~5GB of physical memory.
-const int64_t MAX_SIEVE_LENGTH = (int64_t)1 << 30;
+// Destination of the primes found by ENUMERATE_PRIMES_IN_INTERVAL_CTX(),
+// which collects them in PRIMES and passes them to CALLBACK with DATA
+// whenever PRIMES fills up.  NUM_PASSED counts the primes passed so far,
+// and STOPPED is set once CALLBACK asks to stop.
+typedef struct prime_sink_t {
+  count_primes_callback_t callback;
+  void *data;
+  int64_t count;
+  int64_t num_passed;
+  bool stopped;
+  int64_t primes[PRIME_SINK_ENTRIES];
+} prime_sink_t;
 
-// this static array is used to store temparary large array that is used in
-// count_primes_in_interval_helper
-static sieve_t *large_primes;
+// Number of primes before each prime that STATS_REDUCER_T keeps, i.e.,
+// one less than the largest tuplet it counts.
+#define STATS_WINDOW (PRIME_STATS_MAX_TUPLET - 1)
+
+// A pattern of prime K-tuplet, as the NUM_GAPS = K-1 gaps between its
+// consecutive primes.
+typedef struct tuplet_pattern_t {
+  int k;
+  int num_gaps;
+  int gaps[STATS_WINDOW];
+} tuplet_pattern_t;
+
+// The prime K-tuplets of smallest diameter, for 2 <= K <= 6.
+static const tuplet_pattern_t TUPLET_PATTERNS[] = {
+  { 2, 1, { 2 } },
+  { 3, 2, { 2, 4 } },
+  { 3, 2, { 4, 2 } },
+  { 4, 3, { 2, 4, 2 } },
+  { 5, 4, { 2, 4, 2, 4 } },
+  { 5, 4, { 4, 2, 4, 2 } },
+  { 6, 5, { 4, 2, 4, 2, 4 } }
+};
+
+// Gathers the PRIME_STATS_T of a range of primes fed to it in
+// increasing order.  WINDOW holds the last NUM_WINDOW primes fed, up to
+// STATS_WINDOW, so that gaps and tuplets carry from one segment to the
+// next, and HEAD the first NUM_HEAD of them, so that the ranges of
+// workers can be joined by JOIN_STATS().
+typedef struct stats_reducer_t {
+  prime_stats_t stats;
+  int64_t window[STATS_WINDOW];
+  int num_window;
+  int64_t head[STATS_WINDOW];
+  int num_head;
+} stats_reducer_t;
+
+// Largest modulus for which the primes of each residue class are
+// counted with masks rather than one at a time.  The masks take
+// MODULUS^2 words at most, 32KB for this modulus.
+#define RESIDUE_MASK_MAX_MODULUS 64
+
+// Masks with which RESIDUE_COUNTER_T counts the primes of each residue
+// class modulo a small MODULUS.  Odd integers fall into the NUM_CLASSES
+// classes listed in CLASSES, i.e., the odd classes if MODULUS is even,
+// and all of them otherwise.  In a word of an odd-only sieve whose bit
+// 0 represents an integer congruent to PHASE, bit I represents an
+// integer of class CLASSES[J] if and only if bit I of
+// MASKS[PHASE*NUM_CLASSES + J] is set.
+typedef struct residue_masks_t {
+  int64_t modulus;
+  int64_t num_classes;
+  int64_t classes[RESIDUE_MASK_MAX_MODULUS];
+  uint64_t masks[RESIDUE_MASK_MAX_MODULUS * RESIDUE_MASK_MAX_MODULUS];
+} residue_masks_t;
+
+// Counts of the primes of a worker's range in each residue class
+// modulo MODULUS, where COUNTS[R] counts the class R, plus
+// CLASS_COUNTS[J] for the class MASKS->CLASSES[J] if MASKS is not NULL.
+typedef struct residue_counter_t {
+  int64_t modulus;
+  const residue_masks_t *masks;
+  int64_t *counts;
+  int64_t class_counts[RESIDUE_MASK_MAX_MODULUS];
+} residue_counter_t;
+
+// State of the segmented sieve of one worker, carried from each
+// segment of the worker's range to the next.  Sieving primes P are
+// split into _medium_ primes, P <= SEGMENT_ENTRIES, which are kept in
+// an array and visit every segment, and _large_ primes, which are
+// filed into BUCKETS by the segment of their next multiple.
+typedef struct segment_state_t {
+  // Odd-only scratch sieve for the current segment.
+  sieve_t *large_primes;
+  // Number of entries of a full segment.
+  int64_t segment_entries;
+  // Index of the current segment within the worker's range.
+  int64_t segment_index;
+  // Number of odd integers in the worker's range.
+  int64_t range_entries;
+  // Medium sieving primes in increasing order, of which the first
+  // NUM_SMALL are STAMP_PRIMES.  The first NUM_ACTIVE have offsets
+  // relative to the current segment.
+  wheel_prime_t *medium_primes;
+  int64_t num_medium;
+  int64_t num_small;
+  int64_t num_active;
+  // List of all sieving primes, and the next large prime in it that
+  // has not been filed into BUCKETS yet, or -1.
+  const prime_list_t *sieving_primes;
+  prime_list_cursor_t large_cursor;
+  int64_t next_large_prime;
+  // Buckets of large sieving primes, one per upcoming segment.
+  bucket_sieve_t *buckets;
+  // Destination of the primes found, or NULL to only count them.
+  prime_sink_t *sink;
+  // Statistics of the primes found, or NULL to only count them.
+  stats_reducer_t *stats;
+  // Counts of the primes found by residue class, or NULL.
+  residue_counter_t *residues;
+#ifdef COUNT_PRIMES_PROFILE
+  // Seconds spent in each COUNT_PRIMES_STAGE_T by this worker.
+  double profile[COUNT_PRIMES_NUM_STAGES];
+#endif  // COUNT_PRIMES_PROFILE
+} segment_state_t;
+
+// Buffers of one worker, kept by a COUNT_PRIMES_CTX_T from one query
+// to the next and grown as queries need.  Any of them may be NULL
+// until first needed.
+typedef struct worker_buffers_t {
+  // Scratch sieve, of LARGE_PRIMES->LENGTH entries.
+  sieve_t *large_primes;
+  // Array of MEDIUM_CAPACITY medium sieving primes.
+  wheel_prime_t *medium_primes;
+  int64_t medium_capacity;
+  // Buckets, whose free blocks carry over to the next query.
+  bucket_sieve_t *buckets;
+} worker_buffers_t;
+
+// Arguments and result of one worker thread of
+// COUNT_PRIMES_IN_INTERVAL_CTX().  Each worker counts the primes in its
+// own range [START, START+LENGTH) with its own BUFFERS and stores the
+// count in NUM_PRIMES.  The worker keeps at most MEMORY_BYTES bytes of
+// BUFFERS once done, or all of them if MEMORY_BYTES is nonpositive.
+typedef struct worker_t {
+  pthread_t thread;
+  int64_t start;
+  int64_t length;
+  int64_t segment_entries;
+  const prime_list_t *sieving_primes;
+  worker_buffers_t *buffers;
+  int64_t memory_bytes;
+  prime_sink_t *sink;
+  stats_reducer_t *stats;
+  residue_counter_t *residues;
+  int64_t num_primes;
+} worker_t;
+
+// A context for counting primes: the buffers of NUM_THREADS workers
+// and the sieving primes they used last, kept between queries.
+struct count_primes_ctx_t {
+  int num_threads;
+  int64_t memory_bytes;
+  // Whether a query has exceeded MEMORY_BYTES, and been warned about.
+  bool over_budget;
+  int64_t segment_entries;
+  // Sieving primes acquired with ACQUIRE_SIEVING_PRIMES(), or NULL.
+  shared_primes_t *sieving_primes;
+  worker_t *workers;
+  worker_buffers_t *buffers;
+};
 
 /*************************************************************************
  * Helper methods
  *************************************************************************/
 
-static sieve_t* find_small_primes(int64_t power) {
-  int64_t upper_bound = (int64_t) 1 << power;
-  sieve_t *sieve = create_sieve(upper_bound);
-  if (NULL == sieve) {
-    fprintf(stderr, "Failed to create SMALL_PRIMES sieve of length %"PRId64".\n"\
-            "This failure can occur if there is insufficient physical memory on the system.\n"\
-            "Aborting.\n", upper_bound);
-    exit(1);
+// Return the size of the L2 cache in bytes, or DEFAULT_SEGMENT_BYTES
+// if it cannot be determined.
+static int64_t detect_l2_cache_bytes(void) {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  int64_t size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) {
+    return size;
   }
+#endif  // _SC_LEVEL2_CACHE_SIZE
 
-  // initilize it this way would turn all bits that corresponds
-  // to even number off. This would save time because we don't
-  // have to mark them as composite later (Here odd bits corresponds
-  // to even integers since the count starts from zeroth bit)
-  init_sieve_with_odd_bits_off(sieve, upper_bound);
+  // Fall back on sysfs, which reports sizes such as "2048K".
+  FILE *file = fopen("/sys/devices/system/cpu/cpu0/cache/index2/size", "r");
+  if (NULL != file) {
+    int64_t kilobytes;
+    int matched = fscanf(file, "%"SCNd64"K", &kilobytes);
+    fclose(file);
+    if (1 == matched && kilobytes > 0) {
+      return kilobytes * 1024;
+    }
+  }
+  return DEFAULT_SEGMENT_BYTES;
+}
 
-  mark_composite(sieve, 0);
-  mark_composite(sieve, 1);
-  mark_prime(sieve, 2);
+// Return an upper bound on the number of primes up to N, from \pi(N) <
+// 1.26 N / \ln N, with \ln N underestimated from the bit length of N.
+//
+//   N -- The bound on the primes to count.
+//
+static int64_t max_primes_up_to(int64_t n) {
+  if (n < 64) {
+    return 18;
+  }
+  int log2_n = 63 - __builtin_clzll(n);
+  return (int64_t) (1.26 * n / (0.693 * log2_n)) + 1;
+}
 
-  // Scan the entries of the sieve from 3 to UPPER_BOUND.
-  // The case of prime 2 is already taken care of in init_sieve_with_odd_bits_off.
-  // All the primes after 2 are odd, so loop over odd integers only
-  for (int64_t i = 3; i < upper_bound; i+=2) {
-    tbassert(trialdiv_prime_p(i) == prime_p(sieve, i),
-             "Incorrect primality recorded for %"PRId64" (%d vs %d)\n",
-             i, trialdiv_prime_p(i), prime_p(sieve, i));
+// Return floor(\sqrt{N}) for N >= 0, computed with Newton's method on
+// integers.
+//
+//   N -- The integer whose square root to take.
+//
+static int64_t isqrt(int64_t n) {
+  if (n < 2) {
+    return n;
+  }
+  uint64_t x = n;
+  uint64_t y = (x + 1) / 2;
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+  return x;
+}
 
-    // Skip any I marked as composite
-    if (!prime_p(sieve, i)) {
+// Collect the primes P <= LIMIT with P^2 < MAX read from
+// SIEVING_PRIMES at CURSOR, in increasing order, into the array of
+// SIEVING_PRIME_T in BUFFERS, growing it as needed, and leave CURSOR at
+// the first prime not collected.  The offsets are left for
+// COUNT_PRIMES_IN_INTERVAL_HELPER() to set when each prime becomes
+// active.  Returns the number of primes collected.
+//
+//   SIEVING_PRIMES -- List of the odd sieving primes.
+//
+//   CURSOR -- Cursor into SIEVING_PRIMES at the first prime to collect.
+//
+//   MAX -- The high endpoint of the interval to be sieved.
+//
+//   LIMIT -- The largest prime to collect.
+//
+//   BUFFERS -- The worker's buffers, whose MEDIUM_PRIMES receive the
+//     primes.
+//
+static int64_t collect_sieving_primes(const prime_list_t *sieving_primes,
+                                      prime_list_cursor_t *cursor,
+                                      int64_t max, int64_t limit,
+                                      worker_buffers_t *buffers) {
+  // Count the sieving primes, so that the array can be allocated at
+  // its final size.
+  int64_t count = 0;
+  prime_list_cursor_t scan = *cursor;
+  for (int64_t p = prime_list_next(&scan, sieving_primes);
+       p > 0 && p <= limit && p * p < max;
+       p = prime_list_next(&scan, sieving_primes)) {
+    ++count;
+  }
+
+  if (NULL == buffers->medium_primes || buffers->medium_capacity < count) {
+    free_buffer(buffers->medium_primes,
+                buffers->medium_capacity * sizeof(wheel_prime_t));
+    buffers->medium_capacity = count > 0 ? count : 1;
+    buffers->medium_primes = (wheel_prime_t*)
+        alloc_buffer(buffers->medium_capacity * sizeof(wheel_prime_t));
+    if (NULL == buffers->medium_primes) {
+      fprintf(stderr, "Failed to allocate %"PRId64" sieving primes.\n"\
+              "This can happen if there is insufficient physical memory on the system.\n"\
+              "Aborting.\n", count);
+      exit(1);
+    }
+  }
+
+  wheel_prime_t *primes = buffers->medium_primes;
+  for (int64_t i = 0; i < count; ++i) {
+    primes[i].prime = (uint32_t) prime_list_next(cursor, sieving_primes);
+    primes[i].offset = 0;
+    primes[i].wheel = 0;
+  }
+  return count;
+}
+
+// Free the free bucket blocks of BUFFERS that do not fit in
+// MEMORY_BYTES bytes together with its other buffers.  Nothing is
+// freed if MEMORY_BYTES is nonpositive.
+//
+//   BUFFERS -- The worker's buffers.
+//
+//   MEMORY_BYTES -- The number of bytes of buffers to keep.
+//
+static void trim_worker_buffers(worker_buffers_t *buffers,
+                                int64_t memory_bytes) {
+  if (memory_bytes <= 0 || NULL == buffers->buckets) {
+    return;
+  }
+  int64_t kept = sieve_words(buffers->large_primes->length) * sizeof(uint64_t)
+      + buffers->medium_capacity * sizeof(wheel_prime_t)
+      + buffers->buckets->capacity * sizeof(bucket_block_t*);
+  int64_t max_free_blocks = kept < memory_bytes
+      ? (memory_bytes - kept) / (int64_t) sizeof(bucket_block_t) : 0;
+  trim_bucket_sieve(buffers->buckets, max_free_blocks);
+}
+
+// Free all buffers of BUFFERS.
+//
+//   BUFFERS -- The worker's buffers.
+//
+static void free_worker_buffers(worker_buffers_t *buffers) {
+  if (NULL != buffers->large_primes) {
+    destroy_sieve(buffers->large_primes);
+  }
+  free_buffer(buffers->medium_primes,
+              buffers->medium_capacity * sizeof(wheel_prime_t));
+  if (NULL != buffers->buckets) {
+    destroy_bucket_sieve(buffers->buckets);
+  }
+}
+
+// Pass the primes collected in SINK to its callback, unless it has
+// asked to stop.
+//
+//   SINK -- The destination of the primes.
+//
+static void flush_prime_sink(prime_sink_t *sink) {
+  if (!sink->stopped && sink->count > 0) {
+    sink->num_passed += sink->count;
+    sink->stopped = !sink->callback(sink->primes, sink->count, sink->data);
+  }
+  sink->count = 0;
+}
+
+// Add the prime P to SINK.
+//
+//   SINK -- The destination of the primes.
+//
+//   P -- The next prime, larger than all primes added before.
+//
+static void push_prime(prime_sink_t *sink, int64_t p) {
+  if (PRIME_SINK_ENTRIES == sink->count) {
+    flush_prime_sink(sink);
+  }
+  sink->primes[sink->count++] = p;
+}
+
+// Add the odd integers BASE + 2*I represented by the entries I still
+// marked as prime in the NUM_WORDS words of WORDS, an odd-only sieve,
+// to SINK.  Returns the number of primes added.
+//
+//   SINK -- The destination of the primes.
+//
+//   WORDS -- The words of the sieve.
+//
+//   NUM_WORDS -- The number of words of the sieve.
+//
+//   BASE -- The odd integer represented by entry 0.
+//
+static int64_t push_sieve_primes(prime_sink_t *sink, const uint64_t *words,
+                                 int64_t num_words, int64_t base) {
+  int64_t num_primes = 0;
+  int64_t word = 0;
+  while (word < num_words && !sink->stopped) {
+    // Extract as many words as surely fit in the rest of the sink.
+    int64_t chunk = (PRIME_SINK_ENTRIES - sink->count) / 64;
+    if (0 == chunk) {
+      flush_prime_sink(sink);
       continue;
     }
+    if (chunk > num_words - word) {
+      chunk = num_words - word;
+    }
+    int64_t found = extract_set_bits(words + word, chunk, base + 128 * word,
+                                     2, sink->primes + sink->count);
+    sink->count += found;
+    num_primes += found;
+    word += chunk;
+  }
+  return num_primes;
+}
+
+// Feed the prime P, larger than all primes fed before, to REDUCER.
+// The gaps and tuplets ending at P are counted only if their first
+// prime is below BEFORE.
+//
+//   REDUCER -- The statistics to update.
+//
+//   P -- The next prime.
+//
+//   BEFORE -- Bound on the first prime of the gaps and tuplets to count.
+//
+static inline void reduce_prime(stats_reducer_t *reducer, int64_t p,
+                                int64_t before) {
+  prime_stats_t *stats = &reducer->stats;
+  int n = reducer->num_window;
+  int64_t gap = n > 0 ? p - reducer->window[n - 1] : 0;
+  if (n > 0 && reducer->window[n - 1] < before) {
+    int64_t bucket = gap / 2;
+    if (bucket >= PRIME_STATS_HISTOGRAM_SIZE) {
+      bucket = PRIME_STATS_HISTOGRAM_SIZE - 1;
+    }
+    ++stats->gap_histogram[bucket];
+    if (gap > stats->max_gap) {
+      stats->max_gap = gap;
+      stats->max_gap_start = reducer->window[n - 1];
+    }
+  }
 
-    // At this point, I is prime.
-    // Mark all multiples of I as composite.
-    for (int64_t temp = 2*i; temp < upper_bound; temp += i) {
-      mark_composite(sieve, temp);
+  // Only gaps of 2 and 4 occur in tuplets.
+  if (n > 0 && gap <= 4) {
+    int num_patterns = sizeof(TUPLET_PATTERNS) / sizeof(TUPLET_PATTERNS[0]);
+    for (int i = 0; i < num_patterns; ++i) {
+      const tuplet_pattern_t *pattern = &TUPLET_PATTERNS[i];
+      int first = n - pattern->num_gaps;
+      if (first < 0 || reducer->window[first] >= before) {
+        continue;
+      }
+      int64_t next = p;
+      int j = pattern->num_gaps - 1;
+      for ( ; j >= 0 && next - reducer->window[first + j] == pattern->gaps[j];
+            --j) {
+        next = reducer->window[first + j];
+      }
+      if (j < 0) {
+        ++stats->tuplets[pattern->k];
+      }
     }
   }
-  return sieve;
+
+  if (n == STATS_WINDOW) {
+    memmove(reducer->window, reducer->window + 1,
+            (STATS_WINDOW - 1) * sizeof(int64_t));
+    --n;
+  }
+  reducer->window[n] = p;
+  reducer->num_window = n + 1;
+  if (reducer->num_head < STATS_WINDOW) {
+    reducer->head[reducer->num_head++] = p;
+  }
+  if (0 == stats->num_primes) {
+    stats->first_prime = p;
+  }
+  stats->last_prime = p;
+  ++stats->num_primes;
 }
 
+// Feed the primes BASE + 2*I, for the entries I still marked as prime
+// in the NUM_WORDS words of WORDS, an odd-only sieve, to REDUCER.
+// Returns the number of primes fed.
+//
+//   REDUCER -- The statistics to update.
+//
+//   WORDS -- The words of the sieve.
+//
+//   NUM_WORDS -- The number of words of the sieve.
+//
+//   BASE -- The odd integer represented by entry 0.
+//
+static int64_t reduce_sieve_primes(stats_reducer_t *reducer,
+                                   const uint64_t *words, int64_t num_words,
+                                   int64_t base) {
+  int64_t primes[PRIME_SINK_ENTRIES];
+  int64_t num_primes = 0;
+  for (int64_t word = 0; word < num_words; word += PRIME_SINK_ENTRIES / 64) {
+    int64_t chunk = PRIME_SINK_ENTRIES / 64;
+    if (chunk > num_words - word) {
+      chunk = num_words - word;
+    }
+    int64_t found = extract_set_bits(words + word, chunk, base + 128 * word,
+                                     2, primes);
+    for (int64_t i = 0; i < found; ++i) {
+      reduce_prime(reducer, primes[i], INT64_MAX);
+    }
+    num_primes += found;
+  }
+  return num_primes;
+}
+
+// Append the statistics of NEXT, gathered over a range of primes just
+// after those of REDUCER, to REDUCER.  The gaps and tuplets straddling
+// the two ranges are counted by feeding the first primes of NEXT to
+// REDUCER again.
+//
+//   REDUCER -- The statistics of the earlier range.
+//
+//   NEXT -- The statistics of the later range.
+//
+static void join_stats(stats_reducer_t *reducer, const stats_reducer_t *next) {
+  if (0 == next->stats.num_primes) {
+    return;
+  }
+  prime_stats_t *stats = &reducer->stats;
+  const prime_stats_t *more = &next->stats;
+
+  // Feed the primes of NEXT that end a gap or tuplet starting before
+  // them, counting only those.  With the counts of NEXT added below,
+  // that feeds every prime of NEXT once.
+  int64_t num_primes = stats->num_primes;
+  int64_t first_prime = stats->first_prime;
+  for (int i = 0; i < next->num_head; ++i) {
+    reduce_prime(reducer, next->head[i], more->first_prime);
+  }
+  stats->num_primes = num_primes + more->num_primes;
+  if (0 == num_primes) {
+    stats->first_prime = more->first_prime;
+  } else {
+    stats->first_prime = first_prime;
+  }
+  stats->last_prime = more->last_prime;
+  if (more->num_primes > next->num_head) {
+    memcpy(reducer->window, next->window, sizeof(next->window));
+    reducer->num_window = next->num_window;
+  }
+
+  for (int k = 0; k <= PRIME_STATS_MAX_TUPLET; ++k) {
+    stats->tuplets[k] += more->tuplets[k];
+  }
+  if (more->max_gap > stats->max_gap) {
+    stats->max_gap = more->max_gap;
+    stats->max_gap_start = more->max_gap_start;
+  }
+  for (int64_t i = 0; i < PRIME_STATS_HISTOGRAM_SIZE; ++i) {
+    stats->gap_histogram[i] += more->gap_histogram[i];
+  }
+}
+
+// Fill MASKS for MODULUS, which is at most RESIDUE_MASK_MAX_MODULUS.
+//
+//   MASKS -- The masks to fill.
+//
+//   MODULUS -- The modulus of the residue classes.
+//
+static void init_residue_masks(residue_masks_t *masks, int64_t modulus) {
+  // Number each class that odd integers fall into.
+  int64_t index[RESIDUE_MASK_MAX_MODULUS];
+  masks->modulus = modulus;
+  masks->num_classes = 0;
+  for (int64_t r = 0; r < modulus; ++r) {
+    index[r] = -1;
+  }
+  for (int64_t r = 1 % modulus, i = 0; i < modulus; ++i) {
+    if (index[r] < 0) {
+      index[r] = masks->num_classes;
+      masks->classes[masks->num_classes++] = r;
+    }
+    r = (r + 2) % modulus;
+  }
+
+  memset(masks->masks, 0, sizeof(masks->masks));
+  for (int64_t phase = 0; phase < modulus; ++phase) {
+    uint64_t *row = masks->masks + phase * masks->num_classes;
+    for (int64_t bit = 0; bit < 64; ++bit) {
+      int64_t r = (phase + 2 * bit) % modulus;
+      if (index[r] >= 0) {
+        row[index[r]] |= (uint64_t) 1 << bit;
+      }
+    }
+  }
+}
+
+// Add the prime P to COUNTER.
+//
+//   COUNTER -- The counts by residue class.
+//
+//   P -- The prime.
+//
+static inline void count_residue(residue_counter_t *counter, int64_t p) {
+  ++counter->counts[p % counter->modulus];
+}
+
+// Add the integers BASE + 2*I represented by the entries I still marked
+// as prime in the NUM_WORDS words of WORDS, an odd-only sieve, to
+// COUNTER.  Returns the number of primes added.
+//
+//   COUNTER -- The counts by residue class.
+//
+//   WORDS -- The words of the sieve.
+//
+//   NUM_WORDS -- The number of words of the sieve.
+//
+//   BASE -- The odd integer represented by entry 0.
+//
+static int64_t count_sieve_residues(residue_counter_t *counter,
+                                    const uint64_t *words, int64_t num_words,
+                                    int64_t base) {
+  int64_t modulus = counter->modulus;
+  if (NULL != counter->masks) {
+    // Consecutive words start 128 integers apart.
+    popcount_masked_words(words, num_words, counter->masks->masks,
+                          counter->masks->num_classes, modulus,
+                          base % modulus, 128 % modulus,
+                          counter->class_counts);
+    return popcount_words(words, num_words);
+  }
+
+  int64_t primes[PRIME_SINK_ENTRIES];
+  int64_t num_primes = 0;
+  for (int64_t word = 0; word < num_words; word += PRIME_SINK_ENTRIES / 64) {
+    int64_t chunk = PRIME_SINK_ENTRIES / 64;
+    if (chunk > num_words - word) {
+      chunk = num_words - word;
+    }
+    int64_t found = extract_set_bits(words + word, chunk, base + 128 * word,
+                                     2, primes);
+    for (int64_t i = 0; i < found; ++i) {
+      count_residue(counter, primes[i]);
+    }
+    num_primes += found;
+  }
+  return num_primes;
+}
+
+// Make SHARED the shared sieving primes in place of the current ones,
+// which are freed unless they are in use.  The caller holds
+// SHARED_PRIMES_LOCK.
+//
+//   SHARED -- The new shared sieving primes.
+//
+static void replace_shared_primes(shared_primes_t *shared) {
+  shared_primes_t *old = shared_primes;
+  shared_primes = shared;
+  if (NULL != old && 0 == old->users) {
+    destroy_prime_list(old->list);
+    free(old);
+  }
+}
+
+// Return the sieving primes up to at least LIMIT for an interval whose
+// high endpoint is END, registered as in use until they are passed to
+// RELEASE_SIEVING_PRIMES().  The shared primes are used if they reach
+// LIMIT.  Otherwise the primes are listed, for the reserved endpoint
+// after COUNT_PRIMES_RESERVE(), in which case they become the shared
+// primes.  Aborts if the primes cannot be listed.
+//
+//   LIMIT -- The largest sieving prime needed.
+//
+//   END -- The high endpoint of the interval.
+//
+static shared_primes_t* acquire_sieving_primes(int64_t limit, int64_t end) {
+  pthread_mutex_lock(&shared_primes_lock);
+  shared_primes_t *shared = shared_primes;
+  if (NULL == shared || shared->list->limit < limit) {
+    // Listing the primes while holding the lock makes concurrent calls
+    // wait for this list rather than list the same primes again.
+    if (reserved_end > end) {
+      limit = isqrt(reserved_end - 1);
+    }
+    shared = (shared_primes_t*) malloc(sizeof(shared_primes_t));
+    PROFILE_START(lap);
+    prime_list_t *list = create_prime_list(limit);
+#ifdef COUNT_PRIMES_PROFILE
+    pthread_mutex_lock(&profile_lock);
+    PROFILE_LAP(lap, profile_seconds, COUNT_PRIMES_STAGE_SMALL_PRIMES);
+    pthread_mutex_unlock(&profile_lock);
+#endif  // COUNT_PRIMES_PROFILE
+    if (NULL == shared || NULL == list) {
+      fprintf(stderr, "Failed to list the sieving primes up to %"PRId64".\n"\
+              "This failure can occur if there is insufficient physical memory on the system.\n"\
+              "Aborting.\n", limit);
+      exit(1);
+    }
+    shared->list = list;
+    shared->users = 0;
+    if (reserved_end > 0) {
+      replace_shared_primes(shared);
+    }
+  }
+  ++shared->users;
+  pthread_mutex_unlock(&shared_primes_lock);
+  return shared;
+}
+
+// Unregister a use of SHARED, returned by ACQUIRE_SIEVING_PRIMES(), and
+// free it if it is no longer used nor shared.
+//
+//   SHARED -- The sieving primes to release.
+//
+static void release_sieving_primes(shared_primes_t *shared) {
+  pthread_mutex_lock(&shared_primes_lock);
+  if (0 == --shared->users && shared != shared_primes) {
+    destroy_prime_list(shared->list);
+    free(shared);
+  }
+  pthread_mutex_unlock(&shared_primes_lock);
+}
+
+// Return the index, relative to BASE, of the first odd multiple of
+// the odd prime P that needs to be marked in a segment whose first odd
+// integer is BASE, i.e., the smallest odd multiple of P that is at
+// least both P^2 and BASE.
+//
+//   P -- An odd sieving prime.
+//
+//   BASE -- The first odd integer of the segment.
+//
+static inline int64_t first_multiple_index(int64_t p, int64_t base) {
+  if (p * p >= base) {
+    return odd_sieve_index(base, p * p);
+  }
+  // Work with the distance from BASE rather than the multiple itself,
+  // which may lie beyond INT64_MAX in the last segment below 2^63.
+  // BASE is odd, so BASE+D is odd exactly when D is even.
+  int64_t d = (p - base % p) % p;
+  if (d & 1) {
+    d += p;
+  }
+  return d >> 1;
+}
+
+// File the large sieving prime P, whose next multiple is at index
+// INDEX relative to the current segment of STATE, into the bucket of
+// the segment containing that multiple.  P is dropped if the multiple
+// lies beyond the worker's range.
+//
+//   STATE -- The worker's segmented sieve state.
+//
+//   P -- A large sieving prime.
+//
+//   INDEX -- Index of the next multiple of P, relative to the first
+//     entry of the current segment.
+//
+static inline void file_large_prime(segment_state_t *state, int64_t p,
+                                    int64_t index) {
+  int64_t segment = state->segment_index + index / state->segment_entries;
+  if (segment * state->segment_entries + index % state->segment_entries
+      >= state->range_entries) {
+    return;
+  }
+  bucket_push(state->buckets, segment % state->buckets->num_buckets,
+              (uint32_t) p, (uint32_t) (index % state->segment_entries));
+}
+
+// Fill PRESIEVE_PATTERN and STAMP_MASKS.  Run once through
+// PTHREAD_ONCE().
+static void build_presieve_pattern(void) {
+  for (int i = 0; i < NUM_STAMP_PRIMES; ++i) {
+    int64_t p = STAMP_PRIMES[i];
+    for (int64_t r = 0; r < p; ++r) {
+      for (int64_t bit = r; bit < 64; bit += p) {
+        stamp_masks[i][r] |= (uint64_t) 1 << bit;
+      }
+    }
+  }
+
+  // The odd multiples of P are the entries (P-1)/2 + K*P.  Since P <
+  // 64, those in each word are at bits R, R+P, R+2P, ... for some R <
+  // P, and are cleared at once with the mask of bits 0, P, 2P, ...
+  // shifted by R.  The next word holds one at bit R - 64 mod P.
+  uint64_t masks[NUM_PRESIEVE_PRIMES] = { 0 };
+  int64_t bits[NUM_PRESIEVE_PRIMES];
+  for (int i = 0; i < NUM_PRESIEVE_PRIMES; ++i) {
+    int64_t p = PRESIEVE_PRIMES[i];
+    for (int64_t bit = 0; bit < 64; bit += p) {
+      masks[i] |= (uint64_t) 1 << bit;
+    }
+    bits[i] = (p - 1) / 2;
+  }
+  for (int64_t w = 0; w < PRESIEVE_WORDS; ++w) {
+    uint64_t composites = 0;
+    for (int i = 0; i < NUM_PRESIEVE_PRIMES; ++i) {
+      int64_t p = PRESIEVE_PRIMES[i];
+      composites |= masks[i] << bits[i];
+      bits[i] -= 64 % p;
+      if (bits[i] < 0) {
+        bits[i] += p;
+      }
+    }
+    presieve_pattern[w] = ~composites;
+  }
+}
 
+// Initialize the first ENTRIES entries of the odd-only sieve SIEVE, whose
+// entry I represents BASE + 2*I, with the odd integers coprime to
+// PRESIEVE_PRIMES marked as prime, as well as PRESIEVE_PRIMES
+// themselves.  Bits beyond ENTRIES are cleared.
+//
+//   SIEVE -- The sieve to initialize.
+//
+//   ENTRIES -- The number of entries to initialize.
+//
+//   BASE -- The odd integer represented by entry 0.
+//
+static void presieve(sieve_t *sieve, int64_t entries, int64_t base) {
+  pthread_once(&presieve_once, build_presieve_pattern);
+
+  // Copy the pattern starting from the bit of BASE.  Consecutive bits
+  // of the pattern and of SIEVE both represent consecutive odd
+  // integers.
+  int64_t num_words = sieve_words(entries);
+  uint64_t *words = sieve->primes;
+  fill_periodic_words(words, num_words, presieve_pattern, PRESIEVE_PERIOD,
+                      ((base - 1) / 2) % PRESIEVE_PERIOD);
+  if (0 != entries % 64) {
+    words[num_words - 1] &= ((uint64_t) 1 << (entries % 64)) - 1;
+  }
+
+  // The pattern crosses off PRESIEVE_PRIMES too.
+  if (base <= PRESIEVE_MAX_PRIME) {
+    for (int i = 0; i < NUM_PRESIEVE_PRIMES; ++i) {
+      int64_t index = (PRESIEVE_PRIMES[i] - base) / 2;
+      if (PRESIEVE_PRIMES[i] >= base && index < entries) {
+        mark_prime(sieve, index);
+      }
+    }
+  }
+}
 
 // Helper function for COUNT_PRIMES_IN_INTERVAL() to count the number
-// of primes in [START, START+LENGTH) where 0 < LENGTH <=
-// MAX_SIEVE_LENGTH.  Returns the number of primes in [START,
-// START+LENGTH).
+// of primes in the segment [START, START+LENGTH), where 2 <= START and
+// LENGTH <= 2*STATE->SEGMENT_ENTRIES.  Returns the number of primes in
+// [START, START+LENGTH).
 //
 //   START -- The low endpoint of the interval.
 //
 //   LENGTH -- The length of the interval.
 //
-//   SMALL_PRIMES -- Sieve recording all primes.
+//   STATE -- The segmented sieve state of the calling worker, whose
+//     current segment is [START, START+LENGTH).  The offsets of the
+//     medium primes are advanced to be relative to the next segment,
+//     and the large primes hitting this segment are refiled.
 //
 static int64_t count_primes_in_interval_helper(int64_t start, int64_t length,
-                                               const sieve_t* small_primes) {
-  // Initially all numbers are considered as primes. Once we mark an
-  // integer as composite, we decrement num_primes by 1
-  uint64_t num_primes = length;
-
-  // Using these init methods, we would mark each even integer as composite
-  // if start is an even integer
-  if (start % 2 == 0) {
-    // ex: 10101010
-    init_sieve_with_odd_bits_off(large_primes, length);
-    // Subtract the number of even integers that are marked as composite
-    num_primes -= (length + 1)/2;
-  // if start is an odd integer
-  } else {
-    // ex: 01010101
-    init_sieve_with_even_bits_off(large_primes, length);
-    // Subtract the number of even integers that are marked as composite
-    num_primes -= length/2;
+                                               segment_state_t *state) {
+  sieve_t *large_primes = state->large_primes;
+  wheel_prime_t *primes = state->medium_primes;
+
+  // LARGE_PRIMES is an odd-only sieve whose entry I represents the odd
+  // integer BASE + 2*I, so even integers are never stored.
+  int64_t base = start | 1;
+  int64_t entries = odd_sieve_length(start, length);
+
+  // Initially all odd numbers coprime to PRESIEVE_PRIMES are
+  // considered as primes.  2 is the only even prime.
+  if (start <= 2 && NULL != state->sink) {
+    push_prime(state->sink, 2);
   }
+  if (start <= 2 && NULL != state->stats) {
+    reduce_prime(state->stats, 2, INT64_MAX);
+  }
+  if (start <= 2 && NULL != state->residues) {
+    count_residue(state->residues, 2);
+  }
+  if (0 == entries) {
+    return start <= 2;
+  }
+  PROFILE_START(lap);
+  presieve(large_primes, entries, base);
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_SEGMENT_INIT);
 
-  // if [START, START+LENGTH) includes 2 then mark 2 as prime
-  if (start <= 2) {
-    mark_prime(large_primes, 2 - start);
-    ++num_primes;
+  // Activate the medium sieving primes whose first multiple to mark,
+  // P^2, is below START+LENGTH.  Primes above STAMP_MAX_PRIME start
+  // from the first multiple K*P with K coprime to 30.
+  int64_t active = state->num_active;
+  for ( ; active < state->num_medium; ++active) {
+    int64_t p = primes[active].prime;
+    if (p * p >= start + length) {
+      break;
+    }
+    int64_t kp_index = first_multiple_index(p, base);
+    if (p > STAMP_MAX_PRIME) {
+      // K*P itself may lie beyond INT64_MAX, so find K mod 30 from
+      // BASE mod 30*P and the offset of K*P from BASE.
+      int64_t k = (base % (30 * p) + 2 * kp_index) / p % 30;
+      for ( ; WHEEL30_BIT[k] < 0; k = (k + 2) % 30) {
+        kp_index += p;
+      }
+      primes[active].wheel = WHEEL30_BIT[k];
+    }
+    primes[active].offset = (uint32_t) kp_index;
   }
+  state->num_active = active;
 
-  // Scan all of the potentially prime entries in the SMALL_PRIMES
-  // sieve. The case of 2 is already taken care of inside
-  // init_sieve methods (both for even start and odd start) above.
-  // All primes after 2 are all odd, so loop over odd integers only.
-  for (int64_t p = 3; p < small_primes->length; p+=2) {
-    tbassert(trialdiv_prime_p(p) == prime_p(small_primes, p),
-             "Incorrect primality recorded for %"PRId64" in small_primes\n",
-             p);
+  // Mark the odd multiples of each active medium sieving prime in this
+  // segment as composite.  Consecutive odd multiples of P are 2*P
+  // apart, i.e., P entries apart in the odd-only sieve.  Entries are
+  // cleared unconditionally; the survivors are counted once at the
+  // end.  The small primes, which come first, are stamped a word at
+  // a time, and the others are crossed off along the wheel.
+  int64_t num_small = active < state->num_small ? active : state->num_small;
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_CROSS_MEDIUM);
+  stamp_small_primes(large_primes->primes, entries, primes, num_small,
+                     stamp_masks);
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_CROSS_SMALL);
+  cross_off_wheel_primes(large_primes->primes, entries, primes + num_small,
+                         active - num_small);
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_CROSS_MEDIUM);
 
-    // Skip any entry in SMALL_PRIMES marked as composite.
-    if (!prime_p(small_primes, p)) {
-      continue;
+  // File the large sieving primes whose square is below START+LENGTH
+  // into the buckets.  Those hitting this segment land in its own
+  // bucket, which is processed next.
+  while (state->next_large_prime > 0) {
+    int64_t p = state->next_large_prime;
+    if (p * p >= start + length) {
+      break;
     }
+    file_large_prime(state, p, first_multiple_index(p, base));
+    state->next_large_prime = prime_list_next(&state->large_cursor,
+                                              state->sieving_primes);
+  }
 
-    // At this point, P is a prime.
-    /* DEBUG_EPRINTF("p = %ld\n", p); */
+  // Mark the multiple of each large prime in this segment's bucket,
+  // and refile the prime by its next multiple, at least one segment
+  // ahead.
+  bucket_block_t *blocks =
+      bucket_take(state->buckets,
+                  state->segment_index % state->buckets->num_buckets);
+  for (bucket_block_t *block = blocks; NULL != block; block = block->next) {
+    for (int64_t i = 0; i < block->count; ++i) {
+      int64_t p = block->entries[i].prime;
+      int64_t kp_index = block->entries[i].offset;
+      mark_composite(large_primes, kp_index);
+      file_large_prime(state, p, kp_index + p);
+    }
+  }
+  bucket_release(state->buckets, blocks);
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_CROSS_LARGE);
 
-    // Find index KP_INDEX of smallest multiple of <p> in range
-    // [START,START+LENGTH).
-    int64_t kp_index = start % p;
-    if (0 != kp_index) {
-      kp_index = p - kp_index;
+  int64_t num_primes;
+  if (NULL != state->sink) {
+    // Pass on the entries still marked as prime when enumerating them.
+    num_primes = push_sieve_primes(state->sink, large_primes->primes,
+                                   sieve_words(entries), base);
+  } else if (NULL != state->stats) {
+    // Gather the statistics of the entries still marked as prime in
+    // the same pass that counts them.
+    num_primes = reduce_sieve_primes(state->stats, large_primes->primes,
+                                     sieve_words(entries), base);
+  } else if (NULL != state->residues) {
+    // Count the entries still marked as prime by residue class in the
+    // same pass that counts them.
+    num_primes = count_sieve_residues(state->residues, large_primes->primes,
+                                      sieve_words(entries), base);
+  } else {
+    // Count the entries still marked as prime, a word at a time.
+    num_primes = popcount_words(large_primes->primes, sieve_words(entries));
+  }
+  PROFILE_LAP(lap, state->profile, COUNT_PRIMES_STAGE_COUNT);
+  return num_primes + (start <= 2);
+}
+
+// Count the primes in the range [WORKER->START,
+// WORKER->START+WORKER->LENGTH) one segment of at most
+// 2*WORKER->SEGMENT_ENTRIES integers at a time, using the LARGE_PRIMES
+// sieve, medium-prime offsets, and buckets in WORKER->BUFFERS, which
+// are private to this worker.  Stores the count in WORKER->NUM_PRIMES.
+// Used as the entry point of each worker thread.
+//
+//   ARG -- Pointer to the WORKER_T describing this worker's range.
+//
+static void* count_primes_worker(void *arg) {
+  worker_t *worker = (worker_t*) arg;
+  int64_t start = worker->start;
+  int64_t length = worker->length;
+
+  worker->num_primes = 0;
+  if (length <= 0) {
+    return NULL;
+  }
+
+  // Each segment of SEGMENT_ENTRIES odd integers spans
+  // SEGMENT_LENGTH integers.
+  segment_state_t state;
+  state.sink = worker->sink;
+  state.stats = worker->stats;
+  state.residues = worker->residues;
+#ifdef COUNT_PRIMES_PROFILE
+  memset(state.profile, 0, sizeof(state.profile));
+#endif  // COUNT_PRIMES_PROFILE
+  state.segment_entries = worker->segment_entries;
+  state.segment_index = 0;
+  state.range_entries = odd_sieve_length(start, length);
+  int64_t segment_length = 2 * state.segment_entries;
+  int64_t num_segments = (length - 1) / segment_length + 1;
+
+  worker_buffers_t *buffers = worker->buffers;
+  int64_t sieve_length = state.range_entries < state.segment_entries
+      ? state.range_entries : state.segment_entries;
+  if (sieve_length < 1) {
+    sieve_length = 1;
+  }
+  if (NULL == buffers->large_primes ||
+      buffers->large_primes->length < sieve_length) {
+    if (NULL != buffers->large_primes) {
+      destroy_sieve(buffers->large_primes);
     }
-    if (start + kp_index == p) {
-      kp_index += p;
+    buffers->large_primes = create_sieve(sieve_length);
+    if (NULL == buffers->large_primes) {
+      fprintf(stderr, "Failed to create LARGE_PRIMES sieve of length %"PRId64".\n"\
+              "This can happen if there is insufficient physical memory on the system.\n"\
+              "Aborting.\n", sieve_length);
+      exit(1);
     }
+  }
+  state.large_primes = buffers->large_primes;
+
+  // Primes up to SEGMENT_ENTRIES are medium, and the ones after them
+  // in SIEVING_PRIMES are large.
+  state.sieving_primes = worker->sieving_primes;
+  // Skip the sieving primes crossed off by PRESIEVE().
+  prime_list_cursor_init(&state.large_cursor);
+  for (prime_list_cursor_t scan = state.large_cursor;
+       prime_list_next(&scan, state.sieving_primes) > 0 &&
+       scan.prime <= PRESIEVE_MAX_PRIME; ) {
+    state.large_cursor = scan;
+  }
+  state.num_medium = collect_sieving_primes(state.sieving_primes,
+                                            &state.large_cursor,
+                                            start + length,
+                                            state.segment_entries, buffers);
+  state.medium_primes = buffers->medium_primes;
+  state.num_small = 0;
+  while (state.num_small < state.num_medium &&
+         state.medium_primes[state.num_small].prime <= STAMP_MAX_PRIME) {
+    ++state.num_small;
+  }
+  state.num_active = 0;
+  state.next_large_prime = prime_list_next(&state.large_cursor,
+                                           state.sieving_primes);
 
-    /* DEBUG_EPRINTF("kp_index = %"PRId64"\n", kp_index); */
+  // A large prime P <= \sqrt{START+LENGTH} is never filed more than
+  // P/SEGMENT_ENTRIES + 1 segments ahead, nor beyond the last segment.
+  int64_t num_buckets = isqrt(start + length) / state.segment_entries + 2;
+  if (num_buckets > num_segments) {
+    num_buckets = num_segments;
+  }
+  if (NULL == buffers->buckets) {
+    buffers->buckets = create_bucket_sieve(num_buckets);
+  } else if (!reset_bucket_sieve(buffers->buckets, num_buckets)) {
+    destroy_bucket_sieve(buffers->buckets);
+    buffers->buckets = NULL;
+  }
+  state.buckets = buffers->buckets;
+  if (NULL == state.buckets) {
+    fprintf(stderr, "Failed to create %"PRId64" buckets.\n"\
+            "This can happen if there is insufficient physical memory on the system.\n"\
+            "Aborting.\n", num_buckets);
+    exit(1);
+  }
 
-    // Mark all multiples of P in [KP_INDEX, KP_INDEX+LENGTH) as
-    // composite.
-    for ( ; kp_index < length; kp_index += p) {
-      if (!prime_p(large_primes, kp_index)) {
-        continue;
-      }
-      mark_composite(large_primes, kp_index);
-      --num_primes;
+  // Segment this worker's range into subintervals no longer than
+  // SEGMENT_LENGTH, stopping early if the sink asks to.
+  while (length > 0 && (NULL == state.sink || !state.sink->stopped)) {
+    int64_t this_length = length < segment_length ? length : segment_length;
+    // Count the number of primes in this segment, and add this count
+    // to NUM_PRIMES.
+    worker->num_primes +=
+        count_primes_in_interval_helper(start, this_length, &state);
+    // Update START and LENGTH to handle the next segment
+    start += this_length;
+    length -= this_length;
+    ++state.segment_index;
+  }
+
+  // Empty the buckets of the segments left unsieved, so that they can
+  // be reused.
+  if (length > 0) {
+    for (int64_t i = 0; i < state.buckets->num_buckets; ++i) {
+      bucket_release(state.buckets, bucket_take(state.buckets, i));
     }
   }
 
-  return num_primes;
+  trim_worker_buffers(buffers, worker->memory_bytes);
+#ifdef COUNT_PRIMES_PROFILE
+  pthread_mutex_lock(&profile_lock);
+  for (int i = 0; i < COUNT_PRIMES_NUM_STAGES; ++i) {
+    profile_seconds[i] += state.profile[i];
+  }
+  pthread_mutex_unlock(&profile_lock);
+#endif  // COUNT_PRIMES_PROFILE
+  return NULL;
 }
 
-/*************************************************************************
- * Definitions for methods in header file.                               
- *************************************************************************/
+// Return whether the interval [START, START+LENGTH), where START >= 2,
+// is to be counted with LMO_PI() rather than sieved by NUM_THREADS
+// workers: if requested, or if that is expected to be faster.
+//
+//   START -- The low endpoint of the interval, at least 2.
+//
+//   LENGTH -- The length of the interval, at least NUM_THREADS.
+//
+//   NUM_THREADS -- The number of workers that would sieve the interval.
+//
+static bool prefers_lmo(int64_t start, int64_t length, int num_threads) {
+  return COUNT_PRIMES_LMO == algorithm ||
+      (COUNT_PRIMES_AUTO == algorithm &&
+       lmo_pi_cost(start + length - 1) + lmo_pi_cost(start - 1)
+       < length / num_threads);
+}
 
-int64_t count_primes_in_interval(int64_t start, int64_t length) {
+// Return an estimate of the bytes of buffers each worker of CTX uses
+// to sieve part of an interval of length LENGTH with the primes up to
+// LIMIT.  A worker holds a WHEEL_PRIME_T for each of its medium
+// primes, a SIEVING_PRIME_T in a bucket for each large prime whose
+// next multiple lies in its range, its segment sieve, and a partly
+// filled block per bucket.  A large prime exceeds 2^{15}, so each odd
+// integer of the range is a multiple of at most 4 of them.
+//
+//   CTX -- The context whose workers sieve.
+//
+//   LIMIT -- The largest sieving prime.
+//
+//   LENGTH -- The length of the interval.
+//
+static int64_t worker_bytes(const count_primes_ctx_t *ctx, int64_t limit,
+                            int64_t length) {
+  int64_t num_sieving_primes = max_primes_up_to(limit);
+  int64_t num_medium_primes = max_primes_up_to(
+      limit < ctx->segment_entries ? limit : ctx->segment_entries);
+  int64_t num_filed = num_sieving_primes - num_medium_primes;
+  if (num_filed > 4 * (length / 2 + 1)) {
+    num_filed = 4 * (length / 2 + 1);
+  }
+  return ctx->segment_entries / 8
+      + num_medium_primes * (int64_t) sizeof(wheel_prime_t)
+      + num_filed * (int64_t) sizeof(sieving_prime_t)
+      + (limit / ctx->segment_entries + 2) * (int64_t) sizeof(bucket_block_t);
+}
+
+// Return the number of workers, at most NUM_THREADS and at least 1,
+// whose buffers for sieving an interval of length LENGTH with the
+// primes up to LIMIT fit in the memory budget of CTX, together with
+// the list of those primes, which takes a byte per prime.
+//
+//   CTX -- The context whose budget to fit.
+//
+//   LIMIT -- The largest sieving prime.
+//
+//   LENGTH -- The length of the interval.
+//
+//   NUM_THREADS -- The number of workers to use if the budget allows.
+//
+static int budget_threads(const count_primes_ctx_t *ctx, int64_t limit,
+                          int64_t length, int num_threads) {
+  if (ctx->memory_bytes <= 0) {
+    return num_threads;
+  }
+  int64_t affordable = (ctx->memory_bytes - max_primes_up_to(limit))
+      / worker_bytes(ctx, limit, length);
+  if (affordable < 1) {
+    return 1;
+  }
+  return affordable < num_threads ? (int) affordable : num_threads;
+}
+
+// Return how COUNT_PRIMES_WITH_CTX() counts [START, START+LENGTH),
+// where START >= 2 and START+LENGTH > 2: COUNT_PRIMES_LMO,
+// COUNT_PRIMES_MILLER_RABIN, or COUNT_PRIMES_SIEVE.  NUM_THREADS is
+// lowered to the number of workers that sieve the interval.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval, at least 2.
+//
+//   LENGTH -- The length of the interval.
+//
+//   COUNT_ONLY -- Whether only the number of primes is wanted, rather
+//     than the primes themselves, their statistics, or residues.
+//
+//   NUM_THREADS -- The number of workers to use if the budget allows.
+//
+static count_primes_algorithm_t choose_algorithm(const count_primes_ctx_t *ctx,
+                                                 int64_t start,
+                                                 int64_t length,
+                                                 bool count_only,
+                                                 int *num_threads) {
+  // Never use more threads than the memory budget of CTX affords, or
+  // than there are integers to sieve.
+  int64_t limit = isqrt(start + length - 1);
+  *num_threads = budget_threads(ctx, limit, length, *num_threads);
+  if (*num_threads > length) {
+    *num_threads = (int) length;
+  }
+
+  // Count with LMO_PI() if requested, or if that is expected to be
+  // faster than sieving the interval with NUM_THREADS workers.  LMO_PI()
+  // finds no primes to enumerate, gather statistics of, or classify.
+  if (count_only && prefers_lmo(start, length, *num_threads)) {
+    return COUNT_PRIMES_LMO;
+  }
+
+  // Likewise, test each integer if requested, or if the interval is
+  // too short to pay for listing the sieving primes.
+  if (COUNT_PRIMES_MILLER_RABIN == algorithm ||
+      (COUNT_PRIMES_AUTO == algorithm &&
+       length < limit / MILLER_RABIN_CROSSOVER)) {
+    return COUNT_PRIMES_MILLER_RABIN;
+  }
+  return COUNT_PRIMES_SIEVE;
+}
+
+// Count the primes in [START, START+LENGTH) with the workers and
+// buffers of CTX, and if SINK is not NULL, add them to SINK in
+// increasing order, or if REDUCERS or COUNTERS is not NULL, feed the
+// primes of the range of worker I to REDUCERS[I] or COUNTERS[I].
+// Returns the number of primes, or, if SINK stopped the enumeration,
+// the number of primes found until then.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   SINK -- The destination of the primes, or NULL.
+//
+//   REDUCERS -- Array of CTX->NUM_THREADS empty reducers, or NULL.
+//
+//   COUNTERS -- Array of CTX->NUM_THREADS zeroed residue counters, to
+//     which the primes of each worker's range are added, or NULL.
+//
+static int64_t count_primes_with_ctx(count_primes_ctx_t *ctx,
+                                     int64_t start, int64_t length,
+                                     prime_sink_t *sink,
+                                     stats_reducer_t *reducers,
+                                     residue_counter_t *counters) {
   int64_t num_primes;
-  uint64_t max = start + length;
 
   // Return 0 primes for nonpositive-length intervals.
   if (length <= 0) {
@@ -258,8 +1505,9 @@ int64_t count_primes_in_interval(int64_t start, int64_t length) {
 
   // Return 0 primes for intervals whose high endpoint is at most 2.
   // Because we treat all negative numbers as composite, there are no
-  // primes less than 2.
-  if (max <= 2) {
+  // primes less than 2.  Compare in signed arithmetic so that
+  // intervals lying entirely below 0 are caught here too.
+  if (start + length <= 2) {
     return 0;
   }
 
@@ -269,57 +1517,583 @@ int64_t count_primes_in_interval(int64_t start, int64_t length) {
     start = 2;
   }
 
-  // round max to a power of 2
-  --max;
-  max |= max >> 1;
-  max |= max >> 2;
-  max |= max >> 4;
-  max |= max >> 8;
-  max |= max >> 16;
-  max |= max >> 32;
-  ++max;
-
-  // locate the set bit in max (start from 0)
-  int set_bit = 0;
-  while (!(max & ((uint64_t) 1 << set_bit)))
-    set_bit++;
-
-  // compute the power of the small primes sieve to be created
-  int power = (set_bit / 2) + !(set_bit % 2 == 0);
-  // Create SMALL_PRIMES structure to record the primes less than 2^power
-  sieve_t *small_primes = find_small_primes(power);
-
-  // initialize large_primes to be used inside count_primes_in_interval_helper
-  large_primes = create_sieve(MAX_SIEVE_LENGTH);
-  if (NULL == large_primes) {
-    fprintf(stderr, "Failed to create LARGE_PRIMES sieve of length %"PRId64".\n"\
-            "This can happen if there is insufficient physical memory on the system.\n"\
-            "Aborting.\n", length);
-    exit(1);
+  // Primes are enumerated by a single worker, so that they reach SINK
+  // in order.
+  int64_t limit = isqrt(start + length - 1);
+  int num_threads = NULL != sink ? 1 : ctx->num_threads;
+  count_primes_algorithm_t chosen = choose_algorithm(
+      ctx, start, length,
+      NULL == sink && NULL == reducers && NULL == counters, &num_threads);
+  if (COUNT_PRIMES_LMO == chosen) {
+    return lmo_pi(start + length - 1) - lmo_pi(start - 1);
+  }
+  if (COUNT_PRIMES_MILLER_RABIN == chosen) {
+    if (NULL == sink && NULL == reducers && NULL == counters) {
+      return miller_rabin_count_primes_in_interval(start, length);
+    }
+    num_primes = 0;
+    for (int64_t n = start; n < start + length &&
+             (NULL == sink || !sink->stopped); ++n) {
+      if (miller_rabin_prime_p(n)) {
+        if (NULL != sink) {
+          push_prime(sink, n);
+        } else if (NULL != reducers) {
+          reduce_prime(&reducers[0], n, INT64_MAX);
+        } else {
+          count_residue(&counters[0], n);
+        }
+        ++num_primes;
+      }
+    }
+    return num_primes;
+  }
+
+  // The budget is best effort: one worker sieves even if it does not
+  // fit, in which case say so, once per context.
+  if (ctx->memory_bytes > 0 && !ctx->over_budget) {
+    int64_t bytes = max_primes_up_to(limit)
+        + num_threads * worker_bytes(ctx, limit, length);
+    if (bytes > ctx->memory_bytes) {
+      fprintf(stderr, "Warning: sieving up to %"PRId64" may take up to "
+              "%"PRId64" bytes, over the budget of %"PRId64" bytes.\n",
+              start + length, bytes, ctx->memory_bytes);
+      ctx->over_budget = true;
+    }
+  }
+
+  // List the odd primes P with P^2 < START+LENGTH, i.e., P <=
+  // \sqrt{START+LENGTH-1}, unless the primes of the previous query or
+  // the shared primes already list them.  Workers stop reading the
+  // list at the first prime they do not need, so a longer list serves
+  // as well.
+  if (NULL == ctx->sieving_primes ||
+      ctx->sieving_primes->list->limit < limit) {
+    if (NULL != ctx->sieving_primes) {
+      release_sieving_primes(ctx->sieving_primes);
+    }
+    ctx->sieving_primes = acquire_sieving_primes(limit, start + length);
   }
 
-  // Initialize NUM_PRIMES
+  // Split [START, START+LENGTH) into NUM_THREADS contiguous ranges
+  // whose lengths differ by at most 1.
+  worker_t *workers = ctx->workers;
+  int64_t range_length = length / num_threads;
+  int64_t remainder = length % num_threads;
+  for (int i = 0; i < num_threads; ++i) {
+    workers[i].start = start;
+    workers[i].length = range_length + (i < remainder);
+    workers[i].segment_entries = ctx->segment_entries;
+    workers[i].sieving_primes = ctx->sieving_primes->list;
+    workers[i].buffers = &ctx->buffers[i];
+    workers[i].memory_bytes = ctx->memory_bytes > 0
+        ? ctx->memory_bytes / ctx->num_threads : 0;
+    workers[i].sink = sink;
+    workers[i].stats = NULL != reducers ? &reducers[i] : NULL;
+    workers[i].residues = NULL != counters ? &counters[i] : NULL;
+    start += workers[i].length;
+  }
+
+  // Run the workers.  With a single worker, just run it on the
+  // calling thread.
+  if (1 == num_threads) {
+    count_primes_worker(&workers[0]);
+  } else {
+    for (int i = 0; i < num_threads; ++i) {
+      if (0 != pthread_create(&workers[i].thread, NULL, count_primes_worker,
+                              &workers[i])) {
+        fprintf(stderr, "Failed to create worker thread %d.\nAborting.\n", i);
+        exit(1);
+      }
+    }
+    for (int i = 0; i < num_threads; ++i) {
+      pthread_join(workers[i].thread, NULL);
+    }
+  }
+
+  // Sum the counts of all workers.
   num_primes = 0;
-  // Segment the interval [START, START+LENGTH) into subintervals no
-  // longer than MAX_SIEVE_LENGTH.
-  while (length > MAX_SIEVE_LENGTH) {
-    // Count the number of primes in this segment, and add this count
-    // to NUM_PRIMES.
-    num_primes += count_primes_in_interval_helper(start, MAX_SIEVE_LENGTH,
-                                                  small_primes);
-    // Update START and LENGTH to handle the next segment
-    start += MAX_SIEVE_LENGTH;
-    length -= MAX_SIEVE_LENGTH;
+  for (int i = 0; i < num_threads; ++i) {
+    num_primes += workers[i].num_primes;
+  }
+  return num_primes;
+}
+
+/*************************************************************************
+ * Definitions for methods in header file.                               
+ *************************************************************************/
+
+void count_primes_set_segment_bytes(int64_t bytes) {
+  segment_bytes = bytes;
+}
+
+int64_t count_primes_get_segment_bytes(void) {
+  int64_t bytes = segment_bytes > 0 ? segment_bytes : detect_l2_cache_bytes();
+  return bytes < MAX_SEGMENT_BYTES ? bytes : MAX_SEGMENT_BYTES;
+}
+
+void count_primes_set_algorithm(count_primes_algorithm_t new_algorithm) {
+  algorithm = new_algorithm;
+}
+
+void count_primes_reserve(int64_t end) {
+  reserved_end = end;
+}
+
+void count_primes_prepare(int64_t end) {
+  count_primes_reserve(end);
+  if (end > 2) {
+    release_sieving_primes(acquire_sieving_primes(isqrt(end - 1), end));
+  }
+}
+
+bool count_primes_build_cache(const char *path) {
+  // Every interval below 2^63 is sieved by primes up to
+  // \sqrt{2^63-1}.
+  prime_list_t *list = create_prime_list(isqrt(INT64_MAX));
+  if (NULL == list) {
+    return false;
+  }
+  bool ok = write_prime_list(list, path);
+  destroy_prime_list(list);
+  return ok;
+}
+
+bool count_primes_open_cache(const char *path) {
+  prime_list_t *list = map_prime_list(path);
+  if (NULL == list) {
+    return false;
+  }
+  shared_primes_t *shared = (shared_primes_t*) malloc(sizeof(shared_primes_t));
+  if (NULL == shared) {
+    destroy_prime_list(list);
+    return false;
+  }
+  shared->list = list;
+  shared->users = 0;
+  pthread_mutex_lock(&shared_primes_lock);
+  replace_shared_primes(shared);
+  pthread_mutex_unlock(&shared_primes_lock);
+  return true;
+}
+
+bool count_primes_build_pi_table(const char *path, int64_t step,
+                                 int64_t end, int num_threads) {
+  pi_table_t *table = create_pi_table(step, end / step);
+  if (NULL == table) {
+    return false;
+  }
+  // List the sieving primes once for all of the blocks.
+  count_primes_reserve(table->num_blocks * table->step);
+  count_primes_ctx_t *ctx = create_count_primes_ctx(num_threads, 0);
+  if (NULL == ctx) {
+    destroy_pi_table(table);
+    return false;
+  }
+  for (int64_t k = 0; k < table->num_blocks; ++k) {
+    table->pi[k + 1] = table->pi[k] +
+        count_primes_in_interval_ctx(ctx, k * table->step, table->step);
+  }
+  destroy_count_primes_ctx(ctx);
+  bool ok = write_pi_table(table, path);
+  destroy_pi_table(table);
+  return ok;
+}
+
+bool count_primes_open_pi_table(const char *path) {
+  pi_table_t *table = read_pi_table(path);
+  if (NULL == table) {
+    return false;
+  }
+  if (NULL != pi_table) {
+    destroy_pi_table(pi_table);
+  }
+  pi_table = table;
+  return true;
+}
+
+count_primes_ctx_t* create_count_primes_ctx(int num_threads,
+                                            int64_t memory_bytes) {
+  // Use one thread per online processor if NUM_THREADS is nonpositive.
+  if (num_threads <= 0) {
+    num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) {
+      num_threads = 1;
+    }
+  }
+
+  // Give at most half of the budget to the segment sieves, so that
+  // the rest is left for the sieving primes and buckets.
+  int64_t bytes = count_primes_get_segment_bytes();
+  if (memory_bytes > 0 && bytes > memory_bytes / (2 * num_threads)) {
+    bytes = memory_bytes / (2 * num_threads);
+    if (bytes < MIN_SEGMENT_BYTES) {
+      bytes = MIN_SEGMENT_BYTES;
+    }
+  }
+
+  count_primes_ctx_t *ctx =
+      (count_primes_ctx_t*) malloc(sizeof(count_primes_ctx_t));
+  if (NULL == ctx) {
+    return NULL;
+  }
+  ctx->num_threads = num_threads;
+  ctx->memory_bytes = memory_bytes;
+  ctx->over_budget = false;
+  // Freed buffers kept for reuse would count against the budget too,
+  // so keep none.
+  if (memory_bytes > 0) {
+    limit_buffer_pool(0);
+  }
+  // Each byte of an odd-only segment sieve holds 8 entries.
+  ctx->segment_entries = bytes * 8;
+  ctx->sieving_primes = NULL;
+  ctx->workers = (worker_t*) malloc(num_threads * sizeof(worker_t));
+  ctx->buffers =
+      (worker_buffers_t*) calloc(num_threads, sizeof(worker_buffers_t));
+  if (NULL == ctx->workers || NULL == ctx->buffers) {
+    free(ctx->workers);
+    free(ctx->buffers);
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void destroy_count_primes_ctx(count_primes_ctx_t *ctx) {
+  for (int i = 0; i < ctx->num_threads; ++i) {
+    free_worker_buffers(&ctx->buffers[i]);
+  }
+  if (NULL != ctx->sieving_primes) {
+    release_sieving_primes(ctx->sieving_primes);
+  }
+  free(ctx->workers);
+  free(ctx->buffers);
+  free(ctx);
+}
+
+int64_t count_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                     int64_t start, int64_t length) {
+  // Look up the count of the blocks of PI_TABLE that lie entirely in
+  // [START, START+LENGTH), and count just the partial blocks before
+  // and after them.
+  if (NULL != pi_table && length > 0) {
+    int64_t step = pi_table->step;
+    int64_t end = start + length;
+    int64_t first = start > 0 ? (start - 1) / step + 1 : 0;
+    int64_t last = end / step;
+    if (last > pi_table->num_blocks) {
+      last = pi_table->num_blocks;
+    }
+    if (first < last) {
+      return pi_table->pi[last] - pi_table->pi[first]
+          + count_primes_with_ctx(ctx, start, first * step - start,
+                                  NULL, NULL, NULL)
+          + count_primes_with_ctx(ctx, last * step, end - last * step,
+                                  NULL, NULL, NULL);
+    }
+  }
+  return count_primes_with_ctx(ctx, start, length, NULL, NULL, NULL);
+}
+
+// Return START+LENGTH if COUNT_PRIMES_WITH_CTX() sieves [START,
+// START+LENGTH) with CTX to count its primes, or 0 otherwise.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+static int64_t sieved_end(const count_primes_ctx_t *ctx,
+                          int64_t start, int64_t length) {
+  if (length <= 0 || start + length <= 2) {
+    return 0;
+  }
+  if (start < 2) {
+    length -= 2 - start;
+    start = 2;
+  }
+  int num_threads = ctx->num_threads;
+  if (COUNT_PRIMES_SIEVE != choose_algorithm(ctx, start, length, true,
+                                             &num_threads)) {
+    return 0;
+  }
+  return start + length;
+}
+
+int64_t count_primes_sieved_end(const count_primes_ctx_t *ctx,
+                                int64_t start, int64_t length) {
+  // Only the partial blocks at the ends of the interval are counted
+  // if PI_TABLE covers it, as in COUNT_PRIMES_IN_INTERVAL_CTX().
+  if (NULL != pi_table && length > 0) {
+    int64_t step = pi_table->step;
+    int64_t end = start + length;
+    int64_t first = start > 0 ? (start - 1) / step + 1 : 0;
+    int64_t last = end / step;
+    if (last > pi_table->num_blocks) {
+      last = pi_table->num_blocks;
+    }
+    if (first < last) {
+      int64_t tail_end = sieved_end(ctx, last * step, end - last * step);
+      if (tail_end > 0) {
+        return tail_end;
+      }
+      return sieved_end(ctx, start, first * step - start);
+    }
+  }
+  return sieved_end(ctx, start, length);
+}
+
+// Replace the state file PATH with CHECKPOINT, by writing it to the
+// file TEMP_PATH and renaming that over PATH, so that PATH is never
+// left half-written.  Returns false if the file cannot be written.
+//
+//   PATH -- The path of the state file.
+//
+//   TEMP_PATH -- The path of the file to write first.
+//
+//   CHECKPOINT -- The state to write.
+//
+static bool write_checkpoint(const char *path, const char *temp_path,
+                             const checkpoint_t *checkpoint) {
+  FILE *file = fopen(temp_path, "wb");
+  if (NULL == file) {
+    return false;
+  }
+  bool ok = 1 == fwrite(checkpoint, sizeof(checkpoint_t), 1, file);
+  // Make sure that the state is on disk before it replaces the old one.
+  ok = 0 == fflush(file) && 0 == fsync(fileno(file)) && ok;
+  ok = 0 == fclose(file) && ok;
+  return ok && 0 == rename(temp_path, path);
+}
+
+int64_t count_primes_in_interval_resumable(count_primes_ctx_t *ctx,
+                                           int64_t start, int64_t length,
+                                           const char *path) {
+  checkpoint_t checkpoint;
+  memcpy(checkpoint.magic, CHECKPOINT_MAGIC, sizeof(checkpoint.magic));
+  checkpoint.start = start;
+  checkpoint.length = length;
+  checkpoint.done = 0;
+  checkpoint.count = 0;
+
+  // Pick up where the state file, if any, leaves off, unless it is for
+  // another interval.
+  FILE *file = fopen(path, "rb");
+  if (NULL != file) {
+    checkpoint_t saved;
+    bool ok = 1 == fread(&saved, sizeof(saved), 1, file) &&
+        0 == memcmp(saved.magic, CHECKPOINT_MAGIC, sizeof(saved.magic)) &&
+        saved.start == start && saved.length == length &&
+        saved.done >= 0 && saved.done <= (length > 0 ? length : 0);
+    fclose(file);
+    if (!ok) {
+      return -1;
+    }
+    checkpoint = saved;
+  }
+
+  char *temp_path = (char*) malloc(strlen(path) + sizeof(".tmp"));
+  if (NULL == temp_path) {
+    return -1;
+  }
+  snprintf(temp_path, strlen(path) + sizeof(".tmp"), "%s.tmp", path);
+
+  // List the sieving primes once for the whole interval, rather than
+  // again for each chunk, whose high endpoint keeps growing.
+  if (reserved_end < start + length) {
+    count_primes_reserve(start + length);
+  }
+
+  // Count the rest of the interval a chunk at a time, saving the state
+  // after each chunk.  The integers below 2 hold no primes, and an
+  // interval left to LMO_PI() takes too little time to be worth
+  // splitting, so each is counted in a single chunk.  Chunks start at
+  // a segment per worker, and are then sized to take about
+  // CHECKPOINT_SECONDS at the rate of the last one, growing at most
+  // fourfold at a time.  Chunks, including the last, are never short
+  // enough to be tested integer by integer when the whole interval
+  // would be sieved.
+  int64_t min_chunk = 2 * ctx->segment_entries * ctx->num_threads;
+  if (COUNT_PRIMES_AUTO == algorithm && start + length > 2) {
+    int64_t sieved = isqrt(start + length - 1) / MILLER_RABIN_CROSSOVER;
+    if (length >= sieved && min_chunk < sieved) {
+      min_chunk = sieved;
+    }
+  }
+  int64_t chunk = min_chunk;
+  bool ok = true;
+  while (ok && checkpoint.done < length) {
+    int64_t low = start + checkpoint.done;
+    int64_t rest = length - checkpoint.done;
+    int64_t n = rest - chunk < min_chunk ? rest : chunk;
+    bool sized = true;
+    if (low < 2) {
+      n = rest < 2 - low ? rest : 2 - low;
+      sized = false;
+    } else if (rest < ctx->num_threads ||
+               prefers_lmo(low, rest, ctx->num_threads)) {
+      n = rest;
+      sized = false;
+    }
+    fasttime_t begin = gettime();
+    checkpoint.count += count_primes_in_interval_ctx(ctx, low, n);
+    fasttime_t end = gettime();
+    checkpoint.done += n;
+    ok = write_checkpoint(path, temp_path, &checkpoint);
+
+    if (sized) {
+      double seconds = tdiff(begin, end);
+      double next = 4.0 * n;
+      if (seconds * 4.0 > CHECKPOINT_SECONDS) {
+        next = n * (CHECKPOINT_SECONDS / seconds);
+      }
+      if (next >= (double) length) {
+        chunk = length;
+      } else {
+        chunk = next < min_chunk ? min_chunk : (int64_t) next;
+      }
+    }
+  }
+  free(temp_path);
+  return ok ? checkpoint.count : -1;
+}
+
+int64_t enumerate_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                         int64_t start, int64_t length,
+                                         count_primes_callback_t callback,
+                                         void *data) {
+  prime_sink_t sink;
+  sink.callback = callback;
+  sink.data = data;
+  sink.count = 0;
+  sink.num_passed = 0;
+  sink.stopped = false;
+  count_primes_with_ctx(ctx, start, length, &sink, NULL, NULL);
+  flush_prime_sink(&sink);
+  return sink.num_passed;
+}
+
+// Destination of LIST_PRIMES_IN_INTERVAL_CTX(): room for CAPACITY
+// primes at PRIMES, of which COUNT are filled.
+typedef struct prime_buffer_t {
+  int64_t *primes;
+  int64_t capacity;
+  int64_t count;
+} prime_buffer_t;
+
+// Callback of LIST_PRIMES_IN_INTERVAL_CTX() that copies PRIMES into
+// the PRIME_BUFFER_T DATA, and stops once it is full.
+static bool fill_prime_buffer(const int64_t *primes, int64_t num_primes,
+                              void *data) {
+  prime_buffer_t *buffer = (prime_buffer_t*) data;
+  int64_t room = buffer->capacity - buffer->count;
+  int64_t n = num_primes < room ? num_primes : room;
+  memcpy(buffer->primes + buffer->count, primes, n * sizeof(int64_t));
+  buffer->count += n;
+  return buffer->count < buffer->capacity;
+}
+
+int64_t list_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                    int64_t start, int64_t length,
+                                    int64_t *primes, int64_t capacity) {
+  if (capacity <= 0) {
+    return 0;
+  }
+  prime_buffer_t buffer = { primes, capacity, 0 };
+  enumerate_primes_in_interval_ctx(ctx, start, length, fill_prime_buffer,
+                                   &buffer);
+  return buffer.count;
+}
+
+void prime_stats_in_interval_ctx(count_primes_ctx_t *ctx,
+                                 int64_t start, int64_t length,
+                                 prime_stats_t *stats) {
+  stats_reducer_t *reducers = (stats_reducer_t*)
+      calloc(ctx->num_threads, sizeof(stats_reducer_t));
+  if (NULL == reducers) {
+    fprintf(stderr, "Failed to allocate %d statistics.\nAborting.\n",
+            ctx->num_threads);
+    exit(1);
+  }
+  count_primes_with_ctx(ctx, start, length, NULL, reducers, NULL);
+
+  // Join the ranges of the workers in order.
+  for (int i = 1; i < ctx->num_threads; ++i) {
+    join_stats(&reducers[0], &reducers[i]);
+  }
+  *stats = reducers[0].stats;
+  free(reducers);
+}
+
+int64_t count_primes_by_residue_ctx(count_primes_ctx_t *ctx,
+                                    int64_t start, int64_t length,
+                                    int64_t modulus, int64_t *counts) {
+  memset(counts, 0, modulus * sizeof(int64_t));
+  residue_masks_t *masks = NULL;
+  if (modulus <= RESIDUE_MASK_MAX_MODULUS) {
+    masks = (residue_masks_t*) malloc(sizeof(residue_masks_t));
+    if (NULL != masks) {
+      init_residue_masks(masks, modulus);
+    }
+  }
+
+  // Give each worker counts of its own, and add them up at the end.
+  residue_counter_t *counters = (residue_counter_t*)
+      calloc(ctx->num_threads, sizeof(residue_counter_t));
+  int64_t *worker_counts = (int64_t*)
+      calloc(ctx->num_threads * modulus, sizeof(int64_t));
+  if (NULL == counters || NULL == worker_counts) {
+    fprintf(stderr, "Failed to allocate the counts of %"PRId64" residue classes.\n"\
+            "Aborting.\n", modulus);
+    exit(1);
+  }
+  for (int i = 0; i < ctx->num_threads; ++i) {
+    counters[i].modulus = modulus;
+    counters[i].masks = masks;
+    counters[i].counts = worker_counts + i * modulus;
   }
-  // Count the number of primes in the final segment, and add the
-  // count to NUM_PRIMES.
-  num_primes += count_primes_in_interval_helper(start, length, small_primes);
 
-  // Free SMALL_PRIMES.
-  destroy_sieve(small_primes);
+  int64_t num_primes =
+      count_primes_with_ctx(ctx, start, length, NULL, NULL, counters);
 
-  // Free LARGE_PRIMES structure
-  destroy_sieve(large_primes);
+  for (int i = 0; i < ctx->num_threads; ++i) {
+    for (int64_t r = 0; r < modulus; ++r) {
+      counts[r] += counters[i].counts[r];
+    }
+    for (int64_t j = 0; NULL != masks && j < masks->num_classes; ++j) {
+      counts[masks->classes[j]] += counters[i].class_counts[j];
+    }
+  }
+  free(worker_counts);
+  free(counters);
+  free(masks);
+  return num_primes;
+}
 
+int64_t count_primes_in_interval(int64_t start, int64_t length) {
+  return count_primes_in_interval_parallel(start, length, 1);
+}
+
+int64_t count_primes_in_interval_parallel(int64_t start, int64_t length,
+                                          int num_threads) {
+  count_primes_ctx_t *ctx = create_count_primes_ctx(num_threads, 0);
+  if (NULL == ctx) {
+    fprintf(stderr, "Failed to create a counting context.\nAborting.\n");
+    exit(1);
+  }
+  int64_t num_primes = count_primes_in_interval_ctx(ctx, start, length);
+  destroy_count_primes_ctx(ctx);
   return num_primes;
 }
+
+#ifdef COUNT_PRIMES_PROFILE
+void count_primes_take_profile(double *seconds) {
+  pthread_mutex_lock(&profile_lock);
+  for (int i = 0; i < COUNT_PRIMES_NUM_STAGES; ++i) {
+    seconds[i] = profile_seconds[i];
+    profile_seconds[i] = 0;
+  }
+  pthread_mutex_unlock(&profile_lock);
+}
+#endif  // COUNT_PRIMES_PROFILE
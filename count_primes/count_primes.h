@@ -24,8 +24,229 @@
 #define INCLUDED_COUNT_PRIMES_DOT_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 
-// Return the number of primes in [START, START+LENGTH).
+// Algorithms with which COUNT_PRIMES_IN_INTERVAL() can count primes.
+typedef enum count_primes_algorithm_t {
+  // Pick whichever algorithm is expected to be faster for the
+  // interval.
+  COUNT_PRIMES_AUTO,
+  // Sieve the whole interval with a segmented sieve.
+  COUNT_PRIMES_SIEVE,
+  // Compute \pi(START+LENGTH-1) - \pi(START-1) with LMO_PI() (see
+  // LMO.H).
+  COUNT_PRIMES_LMO,
+  // Test each integer with MILLER_RABIN_PRIME_P() (see TRIALDIV.H).
+  COUNT_PRIMES_MILLER_RABIN
+} count_primes_algorithm_t;
+
+// A context for counting the primes of many intervals in turn.  It
+// owns the segment sieves, sieving-prime offsets, and buckets of its
+// workers, and the sieving primes of its last query, so that later
+// queries reuse them rather than allocate and list them again.  A
+// context must be used by one thread at a time; threads counting at
+// once each use their own.
+typedef struct count_primes_ctx_t count_primes_ctx_t;
+
+// Create a COUNT_PRIMES_CTX_T.  Returns a pointer to the newly created
+// COUNT_PRIMES_CTX_T, or NULL if allocation fails.
+//
+//   NUM_THREADS -- The number of worker threads with which to count
+//     each interval.  A nonpositive value uses one thread per online
+//     processor.
+//
+//   MEMORY_BYTES -- The number of bytes the context may use.  Segments
+//     are shrunk so that the segment sieves take at most half of it,
+//     each interval is sieved by only as many of the worker threads as
+//     it affords along with the sieving primes, and buffers beyond it
+//     are freed after each query.  The budget is best effort: at
+//     least one worker sieves however small the budget, and a warning
+//     is printed to STDERR, once per context, if even that may exceed
+//     it.  A budget also stops freed buffers from being kept for
+//     reuse, in every context (see LIMIT_BUFFER_POOL()).  A nonpositive
+//     value sets no budget.
+//
+count_primes_ctx_t* create_count_primes_ctx(int num_threads,
+                                            int64_t memory_bytes);
+
+// Free the COUNT_PRIMES_CTX_T and all of its buffers.
+//
+//   CTX -- the COUNT_PRIMES_CTX_T to free.
+//
+void destroy_count_primes_ctx(count_primes_ctx_t *ctx);
+
+// Return the number of primes in [START, START+LENGTH), counted with
+// the workers and buffers of CTX.  The segment size is the one in
+// effect when CTX was created.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length endpoint of the interval.
+//
+int64_t count_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                     int64_t start, int64_t length);
+
+// Return the high endpoint of the last part of [START, START+LENGTH)
+// that COUNT_PRIMES_IN_INTERVAL_CTX() sieves with CTX, rather than
+// looking up in the table of \pi(x), counting with LMO_PI(), or
+// testing integer by integer, or 0 if it sieves no part of it.  The
+// largest such endpoint of many intervals is the one to pass to
+// COUNT_PRIMES_RESERVE() before counting them.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+int64_t count_primes_sieved_end(const count_primes_ctx_t *ctx,
+                                int64_t start, int64_t length);
+
+// Like COUNT_PRIMES_IN_INTERVAL_CTX(), but save the progress of the
+// count to the state file PATH about every ten seconds, so that if the
+// process is killed, a later call with the same interval and PATH
+// resumes where it left off rather than starting over.  If PATH does
+// not exist, the count starts from scratch.  The sieving primes are
+// listed once for the whole interval, as after
+// COUNT_PRIMES_RESERVE(START+LENGTH).  Returns -1 if PATH holds the
+// state of another interval or cannot be written.
+//
+//   CTX -- The context with which to count.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   PATH -- The path of the state file.
+//
+int64_t count_primes_in_interval_resumable(count_primes_ctx_t *ctx,
+                                           int64_t start, int64_t length,
+                                           const char *path);
+
+// Callback of ENUMERATE_PRIMES_IN_INTERVAL_CTX(), which receives the
+// primes of the interval in increasing order, NUM_PRIMES at a time
+// starting at PRIMES, together with the DATA passed along.  Returns
+// false to stop the enumeration.  PRIMES is only valid during the call.
+typedef bool (*count_primes_callback_t)(const int64_t *primes,
+                                        int64_t num_primes, void *data);
+
+// Pass each prime in [START, START+LENGTH), in increasing order, to
+// CALLBACK with DATA, in batches of up to a few thousand.  Unless the
+// interval is short enough to test each integer, it is sieved as by
+// COUNT_PRIMES_IN_INTERVAL_CTX(), but with a single worker on the
+// calling thread, so CALLBACK is always called from the calling
+// thread.  Returns the number of primes passed to CALLBACK.
+//
+//   CTX -- The context with which to sieve.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   CALLBACK -- The function receiving the primes.
+//
+//   DATA -- Passed to each call of CALLBACK.
+//
+int64_t enumerate_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                         int64_t start, int64_t length,
+                                         count_primes_callback_t callback,
+                                         void *data);
+
+// Store the first primes in [START, START+LENGTH), in increasing order,
+// to PRIMES, stopping after CAPACITY primes.  Returns the number of
+// primes stored.  A full buffer may be continued from one past its
+// last prime.
+//
+//   CTX -- The context with which to sieve.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   PRIMES -- Pointer to storage for at most CAPACITY primes.
+//
+//   CAPACITY -- The number of primes PRIMES can hold.
+//
+int64_t list_primes_in_interval_ctx(count_primes_ctx_t *ctx,
+                                    int64_t start, int64_t length,
+                                    int64_t *primes, int64_t capacity);
+
+// Number of entries of PRIME_STATS_T.GAP_HISTOGRAM.  The largest gap
+// between primes below 2^63 is about 1500.
+#define PRIME_STATS_HISTOGRAM_SIZE 1024
+
+// Largest K for which PRIME_STATS_T counts prime K-tuplets.
+#define PRIME_STATS_MAX_TUPLET 6
+
+// Statistics of the primes in an interval, gathered by
+// PRIME_STATS_IN_INTERVAL_CTX().  Only primes within the interval are
+// considered, so a gap or tuplet straddling an endpoint is not counted.
+typedef struct prime_stats_t {
+  // The number of primes, and the first and last of them, or 0 if
+  // there are none.
+  int64_t num_primes;
+  int64_t first_prime;
+  int64_t last_prime;
+  // TUPLETS[K] is the number of prime K-tuplets, i.e., runs of K
+  // consecutive primes of the smallest possible diameter for K, for 2
+  // <= K <= PRIME_STATS_MAX_TUPLET.  TUPLETS[2] counts the twin primes
+  // (P, P+2), TUPLETS[3] the triplets (P, P+2, P+6) and (P, P+4, P+6),
+  // and so on up to the sextuplets (P, P+4, P+6, P+10, P+12, P+16).
+  int64_t tuplets[PRIME_STATS_MAX_TUPLET + 1];
+  // The largest gap between consecutive primes, and the prime
+  // preceding its first occurrence, or 0 if there are fewer than two
+  // primes.
+  int64_t max_gap;
+  int64_t max_gap_start;
+  // GAP_HISTOGRAM[G/2] is the number of gaps G between consecutive
+  // primes, where the gap 1 from 2 to 3 counts as 0, and gaps beyond
+  // the histogram count in its last entry.
+  int64_t gap_histogram[PRIME_STATS_HISTOGRAM_SIZE];
+} prime_stats_t;
+
+// Gather the PRIME_STATS_T of [START, START+LENGTH) into STATS, in the
+// same pass over each segment that counts its primes.  Each worker of
+// CTX gathers the statistics of its own range, carrying the last few
+// primes from one segment to the next, and the ranges are then joined
+// in order.
+//
+//   CTX -- The context with which to sieve.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   STATS -- Pointer to storage for the statistics.
+//
+void prime_stats_in_interval_ctx(count_primes_ctx_t *ctx,
+                                 int64_t start, int64_t length,
+                                 prime_stats_t *stats);
+
+// Count the primes in [START, START+LENGTH) in each residue class
+// modulo MODULUS, storing the number of primes P with P % MODULUS == R
+// in COUNTS[R], in the same pass over each segment that counts its
+// primes.  For moduli up to 64, the primes of a whole sieve word are
+// counted class by class with masks; larger moduli take each prime in
+// turn.  Returns the total number of primes.
+//
+//   CTX -- The context with which to sieve.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   MODULUS -- The modulus, at least 1.
+//
+//   COUNTS -- Pointer to storage for MODULUS counts.
+//
+int64_t count_primes_by_residue_ctx(count_primes_ctx_t *ctx,
+                                    int64_t start, int64_t length,
+                                    int64_t modulus, int64_t *counts);
+
+// Return the number of primes in [START, START+LENGTH), with a
+// context of one thread created for this call alone.
 //
 //   START -- The low endpoint of the interval.
 //
@@ -33,4 +254,138 @@
 //
 int64_t count_primes_in_interval(int64_t start, int64_t length);
 
+// Return the number of primes in [START, START+LENGTH), splitting the
+// interval among NUM_THREADS worker threads, with a context created for
+// this call alone.  Like COUNT_PRIMES_IN_INTERVAL() and every context,
+// it may be used from several threads at once, which then share the
+// sieving primes; the settings below must not change while any call is
+// running.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length endpoint of the interval.
+//
+//   NUM_THREADS -- The number of worker threads to use.  A
+//     nonpositive value uses one thread per online processor.
+//
+int64_t count_primes_in_interval_parallel(int64_t start, int64_t length,
+                                          int num_threads);
+
+// Set the size, in bytes of sieve bitmap, of the segments into which
+// COUNT_PRIMES_IN_INTERVAL() and COUNT_PRIMES_IN_INTERVAL_PARALLEL()
+// split an interval.  Each segment of BYTES bytes covers 8*BYTES
+// integers.  A nonpositive value restores the default, which is the
+// size of the L2 cache.
+//
+//   BYTES -- The segment size in bytes.
+//
+void count_primes_set_segment_bytes(int64_t bytes);
+
+// Return the segment size, in bytes of sieve bitmap, that the next
+// call to COUNT_PRIMES_IN_INTERVAL() will use.
+int64_t count_primes_get_segment_bytes(void);
+
+// Set the algorithm used by COUNT_PRIMES_IN_INTERVAL() and
+// COUNT_PRIMES_IN_INTERVAL_PARALLEL().  The default,
+// COUNT_PRIMES_AUTO, uses LMO_PI() when the interval is long compared
+// to (START+LENGTH)^{2/3}, tests each integer when the interval is
+// short compared to \sqrt{START+LENGTH}, and sieves otherwise.
+//
+//   ALGORITHM -- The algorithm to use.
+//
+void count_primes_set_algorithm(count_primes_algorithm_t algorithm);
+
+// Announce that upcoming calls to COUNT_PRIMES_IN_INTERVAL() will
+// count intervals whose high endpoints are at most END.  The first call
+// that sieves then lists the sieving primes for END rather than for its
+// own interval, and later calls reuse them.
+//
+//   END -- The largest high endpoint START+LENGTH to expect.
+//
+void count_primes_reserve(int64_t end);
+
+// Like COUNT_PRIMES_RESERVE(), but list the sieving primes for END
+// right away, unless the cache file or an earlier call already lists
+// them, so that no later call pays for listing them.  Aborts if the
+// primes cannot be listed.
+//
+//   END -- The largest high endpoint START+LENGTH to expect.
+//
+void count_primes_prepare(int64_t end);
+
+// Write a cache file at PATH holding every sieving prime that any
+// interval below 2^63 needs.  Returns false if the file cannot be
+// written.
+//
+//   PATH -- The path of the cache file to create.
+//
+bool count_primes_build_cache(const char *path);
+
+// Use the sieving primes in the cache file PATH, written by
+// COUNT_PRIMES_BUILD_CACHE(), instead of listing them anew for each
+// interval.  The file is mapped read-only and shared with any other
+// process using it.  Returns false if PATH cannot be mapped or is not
+// a cache file.
+//
+//   PATH -- The path of the cache file to use.
+//
+bool count_primes_open_cache(const char *path);
+
+// Write a table of \pi(x) at the multiples of STEP up to END to the file
+// PATH, counting the primes of each block of STEP integers with
+// NUM_THREADS worker threads.  Returns false if the table cannot be
+// allocated or written.
+//
+//   PATH -- The path of the table file to create.
+//
+//   STEP -- The distance between checkpoints, in [1, 2^33].
+//
+//   END -- The end of the table, rounded down to a multiple of STEP.
+//
+//   NUM_THREADS -- The number of worker threads to use, or a
+//   nonpositive number to use one per online processor.
+//
+bool count_primes_build_pi_table(const char *path, int64_t step,
+                                 int64_t end, int num_threads);
+
+// Use the table of \pi(x) in the file PATH, written by
+// COUNT_PRIMES_BUILD_PI_TABLE(), to count the primes in whole blocks of
+// later intervals passed to COUNT_PRIMES_IN_INTERVAL_CTX().  Like
+// COUNT_PRIMES_SET_ALGORITHM(), this must not be called while any
+// interval is being counted.  Returns false if PATH cannot be read or
+// is not a table file.
+//
+//   PATH -- The path of the table file to use.
+//
+bool count_primes_open_pi_table(const char *path);
+
+#ifdef COUNT_PRIMES_PROFILE
+// The stages of sieving an interval, which a build of COUNT_PRIMES.C
+// with COUNT_PRIMES_PROFILE defined times, for the benchmark harness
+// of BENCH.C.
+typedef enum {
+  // Listing the sieving primes.
+  COUNT_PRIMES_STAGE_SMALL_PRIMES,
+  // Filling each segment with the pattern of the primes up to 17.
+  COUNT_PRIMES_STAGE_SEGMENT_INIT,
+  // Stamping the multiples of the primes 19 to 61.
+  COUNT_PRIMES_STAGE_CROSS_SMALL,
+  // Activating and crossing off the other medium primes.
+  COUNT_PRIMES_STAGE_CROSS_MEDIUM,
+  // Filing the large primes into buckets and crossing them off.
+  COUNT_PRIMES_STAGE_CROSS_LARGE,
+  // Counting, or passing on, the primes left in each segment.
+  COUNT_PRIMES_STAGE_COUNT,
+  COUNT_PRIMES_NUM_STAGES
+} count_primes_stage_t;
+
+// Store the seconds spent in each stage since the last call, summed
+// over all workers, to SECONDS, and restart the timing.
+//
+//   SECONDS -- Array of COUNT_PRIMES_NUM_STAGES times, indexed by
+//     COUNT_PRIMES_STAGE_T.
+//
+void count_primes_take_profile(double *seconds);
+#endif  // COUNT_PRIMES_PROFILE
+
 #endif  // INCLUDED_COUNT_PRIMES_DOT_H
@@ -0,0 +1,680 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * Each kernel declared in KERNELS.H has the following variants:
+ *
+ * -) GENERIC: portable C that uses no instructions beyond the x86-64
+ * baseline, e.g., a SWAR bit count instead of POPCNT.
+ *
+ * -) POPCNT: uses the scalar POPCNT instruction, with several
+ * independent accumulators to hide its latency.
+ *
+ * -) AVX2: counts the bits of 32 bytes at a time by looking up the
+ * count of each nibble with VPSHUFB and summing the bytes with VPSADBW.
+ *
+ * -) AVX512: uses the AVX-512 VPOPCNTQ instruction to count 8 words at
+ * a time, and a masked load for the final partial vector.
+ *
+ * EXTRACT_SET_BITS() visits only the set bits of each word, finding the
+ * lowest with a count of trailing zeros and clearing it with X & (X-1).
+ * Its GENERIC variant counts trailing zeros with BSF, and its BMI
+ * variant with TZCNT and clears bits with BLSR.
+ *
+ * FILL_PERIODIC_WORDS() copies runs of words that are all shifted by the
+ * same number of bits from the pattern, combining each pair of
+ * neighboring pattern words with two shifts and an OR.  Its SSE2
+ * variant, which needs nothing beyond the x86-64 baseline, does this
+ * for 2 words at a time, its AVX2 variant for 4, and its AVX512 variant
+ * for 8.
+ *
+ * POPCOUNT_MASKED_WORDS() has GENERIC and POPCNT variants, which count
+ * the bits of each masked word like those of POPCOUNT_WORDS().
+ *
+ * STAMP_SMALL_PRIMES() and CROSS_OFF_WHEEL_PRIMES() cross off the
+ * multiples of the sieving primes of a segment.  Their GENERIC variants
+ * need nothing beyond the x86-64 baseline, and their BMI2 variants let
+ * the compiler use the flag-free shifts and bit tests of BMI1 and BMI2
+ * for the variable shifts and bit indexing of the loops.
+ *
+ * The variants are compiled with GCC's target attribute, so this file
+ * does not need any -m flags and the program runs on any x86-64 CPU.
+ * SELECT_KERNELS() runs before MAIN(), queries the CPU with
+ * __BUILTIN_CPU_SUPPORTS(), and points each kernel at the best variant
+ * the CPU supports.  KERNELS_SELECT_ISA() caps the selection at a lower
+ * instruction set, e.g., to benchmark the variants against each other.
+ *************************************************************************/
+
+#include "./kernels.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+// Kernel variant selected for POPCOUNT_WORDS().
+static int64_t (*popcount_words_impl)(const uint64_t *words,
+                                      int64_t num_words);
+
+// Kernel variant selected for EXTRACT_SET_BITS().
+static int64_t (*extract_set_bits_impl)(const uint64_t *words,
+                                        int64_t num_words, int64_t first,
+                                        int64_t step, int64_t *values);
+
+// Kernel variant selected for FILL_PERIODIC_WORDS().
+static void (*fill_periodic_words_impl)(uint64_t *words, int64_t num_words,
+                                        const uint64_t *pattern,
+                                        int64_t period, int64_t phase);
+
+// Kernel variant selected for STAMP_SMALL_PRIMES().
+static void (*stamp_small_primes_impl)(uint64_t *words, int64_t entries,
+                                       wheel_prime_t *primes,
+                                       int64_t num_primes,
+                                       const uint64_t (*masks)[64]);
+
+// Kernel variant selected for CROSS_OFF_WHEEL_PRIMES().
+static void (*cross_off_wheel_primes_impl)(uint64_t *words, int64_t entries,
+                                           wheel_prime_t *primes,
+                                           int64_t num_primes);
+
+// Kernel variant selected for POPCOUNT_MASKED_WORDS().
+static void (*popcount_masked_words_impl)(const uint64_t *words,
+                                          int64_t num_words,
+                                          const uint64_t *masks,
+                                          int64_t num_masks,
+                                          int64_t num_phases, int64_t phase,
+                                          int64_t step, int64_t *counts);
+
+// Instruction set levels that cap the selected variants, in
+// increasing order.  The BMI variants count as the AVX2 level, since
+// CPUs with AVX2 have BMI1 and BMI2, and every AVX-512 variant as the
+// AVX512 level, whichever AVX-512 subsets it needs.
+enum {
+  ISA_GENERIC,
+  ISA_POPCNT,
+  ISA_AVX2,
+  ISA_AVX512,
+  NUM_ISAS
+};
+
+// Name of each instruction set level.
+static const char *ISA_NAMES[NUM_ISAS] = {
+  "generic", "popcnt", "avx2", "avx512"
+};
+
+// Name of the instruction set of the selected variants.
+static const char *isa_name = "generic";
+
+/*************************************************************************
+ * Kernel variants
+ *************************************************************************/
+
+// Return the number of set bits in X: sum adjacent 1-bit, 2-bit, and
+// 4-bit fields, then add up the 8 byte counts with a multiply.
+static inline int64_t popcount_swar(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
+static int64_t popcount_words_generic(const uint64_t *words,
+                                      int64_t num_words) {
+  int64_t count = 0;
+  for (int64_t i = 0; i < num_words; ++i) {
+    count += popcount_swar(words[i]);
+  }
+  return count;
+}
+
+__attribute__((target("popcnt")))
+static int64_t popcount_words_popcnt(const uint64_t *words,
+                                     int64_t num_words) {
+  uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  int64_t i = 0;
+  for ( ; i + 4 <= num_words; i += 4) {
+    c0 += __builtin_popcountll(words[i]);
+    c1 += __builtin_popcountll(words[i + 1]);
+    c2 += __builtin_popcountll(words[i + 2]);
+    c3 += __builtin_popcountll(words[i + 3]);
+  }
+  for ( ; i < num_words; ++i) {
+    c0 += __builtin_popcountll(words[i]);
+  }
+  return c0 + c1 + c2 + c3;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int64_t popcount_words_avx2(const uint64_t *words,
+                                   int64_t num_words) {
+  // Number of set bits in each nibble value, for each 128-bit lane.
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i acc = _mm256_setzero_si256();
+  int64_t i = 0;
+  for ( ; i + 4 <= num_words; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (words + i));
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                    _mm256_shuffle_epi8(lookup, hi));
+    acc = _mm256_add_epi64(acc,
+                           _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+  }
+  int64_t count = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1)
+      + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  for ( ; i < num_words; ++i) {
+    count += __builtin_popcountll(words[i]);
+  }
+  return count;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int64_t popcount_words_avx512(const uint64_t *words,
+                                     int64_t num_words) {
+  __m512i acc = _mm512_setzero_si512();
+  int64_t i = 0;
+  for ( ; i + 8 <= num_words; i += 8) {
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(
+        _mm512_loadu_si512((const void*) (words + i))));
+  }
+  if (i < num_words) {
+    __mmask8 mask = (__mmask8) ((1U << (num_words - i)) - 1);
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(
+        _mm512_maskz_loadu_epi64(mask, (const void*) (words + i))));
+  }
+  return _mm512_reduce_add_epi64(acc);
+}
+
+// Body of the variants of EXTRACT_SET_BITS(), which the target
+// attribute of each variant compiles with its own instructions.
+static inline int64_t extract_set_bits_body(const uint64_t *words,
+                                            int64_t num_words,
+                                            int64_t first, int64_t step,
+                                            int64_t *values) {
+  int64_t count = 0;
+  for (int64_t i = 0; i < num_words; ++i) {
+    uint64_t x = words[i];
+    int64_t word_first = first + step * 64 * i;
+    while (0 != x) {
+      values[count++] = word_first + step * __builtin_ctzll(x);
+      x &= x - 1;
+    }
+  }
+  return count;
+}
+
+static int64_t extract_set_bits_generic(const uint64_t *words,
+                                        int64_t num_words, int64_t first,
+                                        int64_t step, int64_t *values) {
+  return extract_set_bits_body(words, num_words, first, step, values);
+}
+
+__attribute__((target("bmi")))
+static int64_t extract_set_bits_bmi(const uint64_t *words,
+                                    int64_t num_words, int64_t first,
+                                    int64_t step, int64_t *values) {
+  return extract_set_bits_body(words, num_words, first, step, values);
+}
+
+// Copy to WORDS the NUM_WORDS 64-bit words of PATTERN starting at bit
+// SHIFT of PATTERN[0], one at a time, for the variants of
+// FILL_PERIODIC_WORDS() to finish a run with.
+static inline void fill_shifted_words_tail(uint64_t *words, int64_t num_words,
+                                           const uint64_t *pattern,
+                                           int64_t shift) {
+  for (int64_t i = 0; i < num_words; ++i) {
+    words[i] = 0 == shift ? pattern[i]
+        : (pattern[i] >> shift) | (pattern[i + 1] << (64 - shift));
+  }
+}
+
+// Body of the variants of FILL_PERIODIC_WORDS(), which splits WORDS
+// into runs whose bits all come from one period of PATTERN, and copies
+// each with FILL_RUN.  The target attribute of each variant compiles it
+// with its own instructions.
+static inline void fill_periodic_words_body(
+    uint64_t *words, int64_t num_words, const uint64_t *pattern,
+    int64_t period, int64_t phase,
+    void (*fill_run)(uint64_t*, int64_t, const uint64_t*, int64_t)) {
+  while (num_words > 0) {
+    // The words starting before the end of the period.
+    int64_t run = (period - phase + 63) / 64;
+    if (run > num_words) {
+      run = num_words;
+    }
+    fill_run(words, run, pattern + phase / 64, phase % 64);
+    words += run;
+    num_words -= run;
+    phase += 64 * run;
+    if (phase >= period) {
+      phase -= period;
+    }
+  }
+}
+
+// Copy a run of words for the SSE2 variant of FILL_PERIODIC_WORDS().
+// Shifting a 64-bit lane by 64 bits clears it, so SHIFT = 0 needs no
+// special case.
+static inline void fill_run_sse2(uint64_t *words, int64_t num_words,
+                                 const uint64_t *pattern, int64_t shift) {
+  const __m128i right = _mm_cvtsi64_si128(shift);
+  const __m128i left = _mm_cvtsi64_si128(64 - shift);
+  int64_t i = 0;
+  for ( ; i + 2 <= num_words; i += 2) {
+    __m128i lo = _mm_loadu_si128((const __m128i*) (pattern + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*) (pattern + i + 1));
+    _mm_storeu_si128((__m128i*) (words + i),
+                     _mm_or_si128(_mm_srl_epi64(lo, right),
+                                  _mm_sll_epi64(hi, left)));
+  }
+  fill_shifted_words_tail(words + i, num_words - i, pattern + i, shift);
+}
+
+static void fill_periodic_words_sse2(uint64_t *words, int64_t num_words,
+                                     const uint64_t *pattern,
+                                     int64_t period, int64_t phase) {
+  fill_periodic_words_body(words, num_words, pattern, period, phase,
+                           fill_run_sse2);
+}
+
+__attribute__((target("avx2")))
+static inline void fill_run_avx2(uint64_t *words, int64_t num_words,
+                                 const uint64_t *pattern, int64_t shift) {
+  const __m128i right = _mm_cvtsi64_si128(shift);
+  const __m128i left = _mm_cvtsi64_si128(64 - shift);
+  int64_t i = 0;
+  for ( ; i + 4 <= num_words; i += 4) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*) (pattern + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*) (pattern + i + 1));
+    _mm256_storeu_si256((__m256i*) (words + i),
+                        _mm256_or_si256(_mm256_srl_epi64(lo, right),
+                                        _mm256_sll_epi64(hi, left)));
+  }
+  fill_shifted_words_tail(words + i, num_words - i, pattern + i, shift);
+}
+
+__attribute__((target("avx2")))
+static void fill_periodic_words_avx2(uint64_t *words, int64_t num_words,
+                                     const uint64_t *pattern,
+                                     int64_t period, int64_t phase) {
+  fill_periodic_words_body(words, num_words, pattern, period, phase,
+                           fill_run_avx2);
+}
+
+__attribute__((target("avx512f")))
+static inline void fill_run_avx512(uint64_t *words, int64_t num_words,
+                                   const uint64_t *pattern, int64_t shift) {
+  const __m128i right = _mm_cvtsi64_si128(shift);
+  const __m128i left = _mm_cvtsi64_si128(64 - shift);
+  int64_t i = 0;
+  for ( ; i + 8 <= num_words; i += 8) {
+    __m512i lo = _mm512_loadu_si512((const void*) (pattern + i));
+    __m512i hi = _mm512_loadu_si512((const void*) (pattern + i + 1));
+    _mm512_storeu_si512((void*) (words + i),
+                        _mm512_or_si512(_mm512_srl_epi64(lo, right),
+                                        _mm512_sll_epi64(hi, left)));
+  }
+  fill_shifted_words_tail(words + i, num_words - i, pattern + i, shift);
+}
+
+__attribute__((target("avx512f")))
+static void fill_periodic_words_avx512(uint64_t *words, int64_t num_words,
+                                       const uint64_t *pattern,
+                                       int64_t period, int64_t phase) {
+  fill_periodic_words_body(words, num_words, pattern, period, phase,
+                           fill_run_avx512);
+}
+
+// Cross off the multiples of the small prime PRIME in the first ENTRIES
+// entries of the odd-only sieve WORDS for STAMP_SMALL_PRIMES().  After
+// the first word, each word holding a multiple at bit R < P is cleared
+// with MASKS[R] at once, and the next word holds one at bit R - 64 mod
+// P.
+static inline void stamp_small_prime(uint64_t *words, int64_t entries,
+                                     wheel_prime_t *prime,
+                                     const uint64_t *masks) {
+  int64_t p = prime->prime;
+  int64_t kp_index = prime->offset;
+
+  // Cross off the multiples in the first word one at a time, since
+  // the bits before KP_INDEX might include P itself.
+  int64_t end_of_word = (kp_index / 64 + 1) * 64;
+  for ( ; kp_index < entries && kp_index < end_of_word; kp_index += p) {
+    words[kp_index / 64] &= ~((uint64_t) 1 << (kp_index % 64));
+  }
+
+  if (kp_index < entries) {
+    int64_t num_words = sieve_words(entries);
+    int64_t r = kp_index % 64;
+    int64_t shift = 64 % p;
+    for (int64_t w = kp_index / 64; w < num_words; ++w) {
+      words[w] &= ~masks[r];
+      r -= shift;
+      if (r < 0) {
+        r += p;
+      }
+    }
+    // The multiple at bit R of the word after the sieve may have been
+    // preceded by some beyond ENTRIES in the last word.
+    kp_index = num_words * 64 + r;
+    while (kp_index - p >= entries) {
+      kp_index -= p;
+    }
+  }
+
+  // Record where the next segment picks up.
+  prime->offset = (uint32_t) (kp_index - entries);
+}
+
+// Clear the bit of entry INDEX of the odd-only sieve WORDS.
+#define CROSS_OFF(words, index) \
+  ((words)[(index) / 64] &= ~((uint64_t) 1 << ((index) % 64)))
+
+// Cross off a whole turn of the wheel, the 8 odd multiples K*P with K
+// = 30J + 1, 30J + 7, ..., 30J + 29 coprime to 30, where the first is
+// at entry INDEX of the odd-only sieve WORDS and the turn spans 15*P
+// entries.  The distances between them are the constants
+// WHEEL30_GAPS[B]/2, times P.
+#define CROSS_OFF_WHEEL_TURN(words, index, p)   \
+  do {                                          \
+    CROSS_OFF(words, index);                    \
+    CROSS_OFF(words, (index) + 3 * (p));        \
+    CROSS_OFF(words, (index) + 5 * (p));        \
+    CROSS_OFF(words, (index) + 6 * (p));        \
+    CROSS_OFF(words, (index) + 8 * (p));        \
+    CROSS_OFF(words, (index) + 9 * (p));        \
+    CROSS_OFF(words, (index) + 11 * (p));       \
+    CROSS_OFF(words, (index) + 14 * (p));       \
+  } while (0)
+
+// Cross off the multiples of PRIME coprime to 30 in the first ENTRIES
+// entries of the odd-only sieve WORDS for CROSS_OFF_WHEEL_PRIMES().
+// Whole turns of the wheel are crossed off with CROSS_OFF_WHEEL_TURN()
+// without checking bounds.
+static inline void cross_off_wheel_prime(uint64_t *words, int64_t entries,
+                                         wheel_prime_t *prime) {
+  int64_t p = prime->prime;
+  int64_t kp_index = prime->offset;
+  int wheel = prime->wheel;
+
+  // Step along the wheel to the start of the next turn.
+  for ( ; 0 != wheel && kp_index < entries; wheel = (wheel + 1) % 8) {
+    CROSS_OFF(words, kp_index);
+    kp_index += WHEEL30_GAPS[wheel] / 2 * p;
+  }
+  // The last multiple of a turn is 14*P entries after its first.
+  if (0 == wheel) {
+    for ( ; kp_index + 14 * p < entries; kp_index += 15 * p) {
+      CROSS_OFF_WHEEL_TURN(words, kp_index, p);
+    }
+  }
+  // Step along the rest of the segment.
+  for ( ; kp_index < entries; wheel = (wheel + 1) % 8) {
+    CROSS_OFF(words, kp_index);
+    kp_index += WHEEL30_GAPS[wheel] / 2 * p;
+  }
+
+  // Record where the next segment picks up.
+  prime->offset = (uint32_t) (kp_index - entries);
+  prime->wheel = wheel;
+}
+
+// Body of the variants of STAMP_SMALL_PRIMES(), which the target
+// attribute of each variant compiles with its own instructions.
+static inline void stamp_small_primes_body(uint64_t *words, int64_t entries,
+                                           wheel_prime_t *primes,
+                                           int64_t num_primes,
+                                           const uint64_t (*masks)[64]) {
+  for (int64_t i = 0; i < num_primes; ++i) {
+    stamp_small_prime(words, entries, &primes[i], masks[i]);
+  }
+}
+
+static void stamp_small_primes_generic(uint64_t *words, int64_t entries,
+                                       wheel_prime_t *primes,
+                                       int64_t num_primes,
+                                       const uint64_t (*masks)[64]) {
+  stamp_small_primes_body(words, entries, primes, num_primes, masks);
+}
+
+__attribute__((target("bmi,bmi2")))
+static void stamp_small_primes_bmi2(uint64_t *words, int64_t entries,
+                                    wheel_prime_t *primes,
+                                    int64_t num_primes,
+                                    const uint64_t (*masks)[64]) {
+  stamp_small_primes_body(words, entries, primes, num_primes, masks);
+}
+
+// Body of the variants of CROSS_OFF_WHEEL_PRIMES(), which the target
+// attribute of each variant compiles with its own instructions.
+static inline void cross_off_wheel_primes_body(uint64_t *words,
+                                               int64_t entries,
+                                               wheel_prime_t *primes,
+                                               int64_t num_primes) {
+  for (int64_t i = 0; i < num_primes; ++i) {
+    cross_off_wheel_prime(words, entries, &primes[i]);
+  }
+}
+
+static void cross_off_wheel_primes_generic(uint64_t *words, int64_t entries,
+                                           wheel_prime_t *primes,
+                                           int64_t num_primes) {
+  cross_off_wheel_primes_body(words, entries, primes, num_primes);
+}
+
+__attribute__((target("bmi,bmi2")))
+static void cross_off_wheel_primes_bmi2(uint64_t *words, int64_t entries,
+                                        wheel_prime_t *primes,
+                                        int64_t num_primes) {
+  cross_off_wheel_primes_body(words, entries, primes, num_primes);
+}
+
+// Body of the variants of POPCOUNT_MASKED_WORDS(), which counts bits
+// with the POPCNT instruction if HARDWARE is true, and with
+// POPCOUNT_SWAR() otherwise.  The target attribute of each variant
+// compiles it with its own instructions.
+static inline void popcount_masked_words_body(const uint64_t *words,
+                                              int64_t num_words,
+                                              const uint64_t *masks,
+                                              int64_t num_masks,
+                                              int64_t num_phases,
+                                              int64_t phase, int64_t step,
+                                              int64_t *counts,
+                                              bool hardware) {
+  for (int64_t i = 0; i < num_words; ++i) {
+    uint64_t x = words[i];
+    const uint64_t *row = masks + phase * num_masks;
+    for (int64_t j = 0; 0 != x && j < num_masks; ++j) {
+      counts[j] += hardware ? __builtin_popcountll(x & row[j])
+          : popcount_swar(x & row[j]);
+    }
+    phase += step;
+    if (phase >= num_phases) {
+      phase -= num_phases;
+    }
+  }
+}
+
+static void popcount_masked_words_generic(const uint64_t *words,
+                                          int64_t num_words,
+                                          const uint64_t *masks,
+                                          int64_t num_masks,
+                                          int64_t num_phases, int64_t phase,
+                                          int64_t step, int64_t *counts) {
+  popcount_masked_words_body(words, num_words, masks, num_masks, num_phases,
+                             phase, step, counts, false);
+}
+
+__attribute__((target("popcnt")))
+static void popcount_masked_words_popcnt(const uint64_t *words,
+                                         int64_t num_words,
+                                         const uint64_t *masks,
+                                         int64_t num_masks,
+                                         int64_t num_phases, int64_t phase,
+                                         int64_t step, int64_t *counts) {
+  popcount_masked_words_body(words, num_words, masks, num_masks, num_phases,
+                             phase, step, counts, true);
+}
+
+/*************************************************************************
+ * Kernel selection
+ *************************************************************************/
+
+// Return whether a variant of instruction set level ISA may be selected
+// under the cap MAX_ISA, given whether the CPU has the features it
+// needs, and if so raise *USED to ISA.
+//
+//   ISA -- The level of the variant.
+//
+//   SUPPORTED -- Whether the CPU has the features the variant needs.
+//
+//   MAX_ISA -- The highest level that may be selected.
+//
+//   USED -- The highest level selected so far.
+//
+static bool use_variant(int isa, bool supported, int max_isa, int *used) {
+  if (!supported || isa > max_isa) {
+    return false;
+  }
+  if (isa > *used) {
+    *used = isa;
+  }
+  return true;
+}
+
+// Point each kernel at the best variant supported by this CPU that
+// needs no instruction set above the level MAX_ISA.  Each kernel checks
+// the features of its own variants, e.g., the AVX-512 fill needs only
+// AVX-512F, whereas the AVX-512 popcount also needs VPOPCNTDQ.
+static void select_kernels_up_to(int max_isa) {
+  bool popcnt = __builtin_cpu_supports("popcnt");
+  bool avx2 = __builtin_cpu_supports("avx2");
+  bool avx512f = __builtin_cpu_supports("avx512f");
+  bool bmi = __builtin_cpu_supports("bmi");
+  bool bmi2 = __builtin_cpu_supports("bmi2");
+  int used = ISA_GENERIC;
+
+  if (use_variant(ISA_AVX512,
+                  avx512f && __builtin_cpu_supports("avx512vpopcntdq"),
+                  max_isa, &used)) {
+    popcount_words_impl = popcount_words_avx512;
+  } else if (use_variant(ISA_AVX2, avx2 && popcnt, max_isa, &used)) {
+    popcount_words_impl = popcount_words_avx2;
+  } else if (use_variant(ISA_POPCNT, popcnt, max_isa, &used)) {
+    popcount_words_impl = popcount_words_popcnt;
+  } else {
+    popcount_words_impl = popcount_words_generic;
+  }
+
+  if (use_variant(ISA_POPCNT, popcnt, max_isa, &used)) {
+    popcount_masked_words_impl = popcount_masked_words_popcnt;
+  } else {
+    popcount_masked_words_impl = popcount_masked_words_generic;
+  }
+
+  if (use_variant(ISA_AVX512, avx512f, max_isa, &used)) {
+    fill_periodic_words_impl = fill_periodic_words_avx512;
+  } else if (use_variant(ISA_AVX2, avx2, max_isa, &used)) {
+    fill_periodic_words_impl = fill_periodic_words_avx2;
+  } else {
+    fill_periodic_words_impl = fill_periodic_words_sse2;
+  }
+
+  if (use_variant(ISA_AVX2, bmi, max_isa, &used)) {
+    extract_set_bits_impl = extract_set_bits_bmi;
+  } else {
+    extract_set_bits_impl = extract_set_bits_generic;
+  }
+
+  if (use_variant(ISA_AVX2, bmi && bmi2, max_isa, &used)) {
+    stamp_small_primes_impl = stamp_small_primes_bmi2;
+    cross_off_wheel_primes_impl = cross_off_wheel_primes_bmi2;
+  } else {
+    stamp_small_primes_impl = stamp_small_primes_generic;
+    cross_off_wheel_primes_impl = cross_off_wheel_primes_generic;
+  }
+
+  isa_name = ISA_NAMES[used];
+}
+
+// Point each kernel at the best variant supported by this CPU.  Runs
+// automatically before MAIN(), so the kernels are never called
+// unselected and the selection needs no locking.
+__attribute__((constructor))
+static void select_kernels(void) {
+  __builtin_cpu_init();
+  select_kernels_up_to(NUM_ISAS - 1);
+}
+
+/*************************************************************************
+ * Definitions for methods in header file.
+ *************************************************************************/
+
+int64_t popcount_words(const uint64_t *words, int64_t num_words) {
+  return popcount_words_impl(words, num_words);
+}
+
+int64_t extract_set_bits(const uint64_t *words, int64_t num_words,
+                         int64_t first, int64_t step, int64_t *values) {
+  return extract_set_bits_impl(words, num_words, first, step, values);
+}
+
+void fill_periodic_words(uint64_t *words, int64_t num_words,
+                         const uint64_t *pattern, int64_t period,
+                         int64_t phase) {
+  fill_periodic_words_impl(words, num_words, pattern, period, phase);
+}
+
+void stamp_small_primes(uint64_t *words, int64_t entries,
+                        wheel_prime_t *primes, int64_t num_primes,
+                        const uint64_t (*masks)[64]) {
+  stamp_small_primes_impl(words, entries, primes, num_primes, masks);
+}
+
+void cross_off_wheel_primes(uint64_t *words, int64_t entries,
+                            wheel_prime_t *primes, int64_t num_primes) {
+  cross_off_wheel_primes_impl(words, entries, primes, num_primes);
+}
+
+void popcount_masked_words(const uint64_t *words, int64_t num_words,
+                           const uint64_t *masks, int64_t num_masks,
+                           int64_t num_phases, int64_t phase, int64_t step,
+                           int64_t *counts) {
+  popcount_masked_words_impl(words, num_words, masks, num_masks, num_phases,
+                             phase, step, counts);
+}
+
+bool kernels_select_isa(const char *name) {
+  for (int isa = 0; isa < NUM_ISAS; ++isa) {
+    if (strcmp(name, ISA_NAMES[isa]) == 0) {
+      select_kernels_up_to(isa);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* kernels_isa_name(void) {
+  return isa_name;
+}
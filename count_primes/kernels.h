@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files KERNELS.{H,C} declare and define the hot-path kernels that
+ * operate on whole words of a SIEVE_T bitmap.  Each kernel is compiled
+ * in several variants for different instruction sets, and the fastest
+ * variant supported by the CPU is selected once at program startup.
+ * See the documentation in KERNELS.C for the available variants.
+ *************************************************************************/
+
+#ifndef INCLUDED_KERNELS_DOT_H
+#define INCLUDED_KERNELS_DOT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "./sieve.h"
+
+// Return the number of set bits in the NUM_WORDS 64-bit words
+// starting at WORDS.
+//
+//   WORDS -- The words to count.
+//
+//   NUM_WORDS -- The number of words to count.
+//
+int64_t popcount_words(const uint64_t *words, int64_t num_words);
+
+// Store FIRST + STEP*I, for the index I of each set bit in the
+// NUM_WORDS 64-bit words starting at WORDS, in increasing order of I,
+// to VALUES.  Returns the number of values stored, which is at most
+// 64*NUM_WORDS.
+//
+//   WORDS -- The words to scan.
+//
+//   NUM_WORDS -- The number of words to scan.
+//
+//   FIRST -- The value of bit 0 of WORDS[0].
+//
+//   STEP -- The difference between the values of consecutive bits.
+//
+//   VALUES -- Pointer to storage for the values.
+//
+int64_t extract_set_bits(const uint64_t *words, int64_t num_words,
+                         int64_t first, int64_t step, int64_t *values);
+
+// Fill the NUM_WORDS 64-bit words starting at WORDS with the bits of a
+// pattern that repeats every PERIOD bits, starting from bit PHASE of it:
+// bit I of WORDS is bit (PHASE + I) % PERIOD of PATTERN.
+//
+//   WORDS -- The words to fill.
+//
+//   NUM_WORDS -- The number of words to fill.
+//
+//   PATTERN -- One period of the pattern, followed by at least its
+//     first 128 bits again.
+//
+//   PERIOD -- The number of bits in a period of the pattern.
+//
+//   PHASE -- The bit of PATTERN to copy to bit 0 of WORDS, in [0,
+//     PERIOD).
+//
+void fill_periodic_words(uint64_t *words, int64_t num_words,
+                         const uint64_t *pattern, int64_t period,
+                         int64_t phase);
+
+// Cross off the multiples of each of the NUM_PRIMES primes in PRIMES,
+// which are small enough that a word holds several multiples, in the
+// first ENTRIES entries of the odd-only sieve WORDS, starting from the
+// offset of each prime, and advance the offsets to be relative to the
+// next segment.
+//
+//   WORDS -- The words of the sieve.
+//
+//   ENTRIES -- The number of entries of the segment.
+//
+//   PRIMES -- The primes, whose OFFSETs are updated.
+//
+//   NUM_PRIMES -- The number of primes.
+//
+//   MASKS -- For each prime P, the masks that clear its multiples in a
+//     word whose first multiple is at bit R < P, indexed by R.
+//
+void stamp_small_primes(uint64_t *words, int64_t entries,
+                        wheel_prime_t *primes, int64_t num_primes,
+                        const uint64_t (*masks)[64]);
+
+// Cross off the multiples coprime to 30 of each of the NUM_PRIMES
+// primes in PRIMES in the first ENTRIES entries of the odd-only sieve
+// WORDS, starting from the offset and position on the wheel of each
+// prime, and advance both to be relative to the next segment.
+//
+//   WORDS -- The words of the sieve.
+//
+//   ENTRIES -- The number of entries of the segment.
+//
+//   PRIMES -- The primes, all greater than 5, whose OFFSETs and WHEELs
+//     are updated.
+//
+//   NUM_PRIMES -- The number of primes.
+//
+void cross_off_wheel_primes(uint64_t *words, int64_t entries,
+                            wheel_prime_t *primes, int64_t num_primes);
+
+// Add the number of set bits of each word of the NUM_WORDS 64-bit
+// words starting at WORDS that are also set in each of NUM_MASKS masks
+// to COUNTS.  The masks applied to each word cycle through NUM_PHASES
+// rows of NUM_MASKS masks each: WORDS[I] is masked by row PHASE_I of
+// MASKS, where PHASE_0 = PHASE and PHASE_{I+1} = (PHASE_I + STEP) %
+// NUM_PHASES, and COUNTS[J] receives the bits under mask J of its row.
+//
+//   WORDS -- The words to count.
+//
+//   NUM_WORDS -- The number of words to count.
+//
+//   MASKS -- NUM_PHASES rows of NUM_MASKS masks each.
+//
+//   NUM_MASKS -- The number of masks per row.
+//
+//   NUM_PHASES -- The number of rows.
+//
+//   PHASE -- The row of WORDS[0], in [0, NUM_PHASES).
+//
+//   STEP -- The increase of the row from one word to the next, in [0,
+//     NUM_PHASES).
+//
+//   COUNTS -- Array of NUM_MASKS counts to add to.
+//
+void popcount_masked_words(const uint64_t *words, int64_t num_words,
+                           const uint64_t *masks, int64_t num_masks,
+                           int64_t num_phases, int64_t phase, int64_t step,
+                           int64_t *counts);
+
+// Select the kernel variants for the instruction set NAME, one of
+// "generic", "popcnt", "avx2", and "avx512", in place of those selected
+// at startup, e.g., to compare their performance.  Each kernel uses
+// its best variant that needs no more than NAME and is supported by
+// this CPU.  Returns false, leaving the selection unchanged, if NAME is
+// not one of these.  Must not be called while kernels are running.
+bool kernels_select_isa(const char *name);
+
+// Return the name of the instruction set whose kernel variants were
+// selected, e.g., "avx2".
+const char* kernels_isa_name(void);
+
+#endif  // INCLUDED_KERNELS_DOT_H
@@ -0,0 +1,605 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include "./lmo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./kernels.h"
+#include "./sieve.h"
+
+// Number C of the smallest primes, 2 through 13, whose multiples are
+// removed by the table of \phi(V, C), and their product and totient.
+#define PHI_C 6
+#define PHI_PRIMORIAL 30030
+#define PHI_TOTIENT 5760
+
+// Below this X, LMO_PI() just lists the primes up to X.
+#define LMO_MIN_X 100000
+
+// Scale factor ALPHA of Y = ALPHA * X^{1/3}.  A larger Y shifts work
+// from the sieve of [1, X/Y] to the leaves and the tables up to Y.
+#define LMO_ALPHA 4
+
+// Running time of LMO_PI(X) divided by X^{2/3}, relative to the time
+// to sieve one integer.
+#define LMO_COST_FACTOR 2
+
+// Number of odd integers in a segment of the sieves of [0, X/Y].
+#define LMO_SEGMENT_ENTRIES ((int64_t) 1 << 17)
+
+// Tables of arithmetic functions of the integers up to Y.
+typedef struct lmo_tables_t {
+  int64_t y;
+  // MU[N] is the Moebius function of N.
+  int8_t *mu;
+  // LPF[N] is the least prime factor of N, with LPF[1] = UINT32_MAX.
+  uint32_t *lpf;
+  // PRIMES[1..NUM_PRIMES] are the primes up to Y; PRIMES[0] = 0.
+  uint32_t *primes;
+  int64_t num_primes;
+  // PI[N] is the number of primes up to N.
+  uint32_t *pi;
+  // PHI_TABLE[R] is the number of integers in [1, R] coprime to
+  // PHI_PRIMORIAL.
+  uint16_t phi_table[PHI_PRIMORIAL];
+} lmo_tables_t;
+
+// An ascending cursor over \pi(V), for nondecreasing V, backed by a
+// segmented odd-only sieve.  Entry I of SIEVE is the odd integer LOW +
+// 2*I + 1 of the current segment [LOW, HIGH).
+typedef struct prime_counter_t {
+  sieve_t *sieve;
+  int64_t low;
+  int64_t high;
+  // Sieving primes and the next odd multiple of each to mark.
+  const uint32_t *primes;
+  int64_t num_primes;
+  int64_t *next;
+  // \pi(LOW - 1), and that plus the primes in the first WORD words of
+  // SIEVE.
+  int64_t count_before;
+  int64_t word;
+  int64_t running;
+} prime_counter_t;
+
+/*************************************************************************
+ * Helper methods
+ *************************************************************************/
+
+// Print an allocation failure message for WHAT and exit.
+//
+//   WHAT -- Description of what could not be allocated.
+//
+static void lmo_out_of_memory(const char *what) {
+  fprintf(stderr, "Failed to allocate %s.\n"\
+          "This can happen if there is insufficient physical memory on the system.\n"\
+          "Aborting.\n", what);
+  exit(1);
+}
+
+// Return floor(\sqrt{N}) for N >= 0.
+//
+//   N -- The integer whose square root to take.
+//
+static int64_t lmo_isqrt(int64_t n) {
+  if (n < 2) {
+    return n;
+  }
+  uint64_t x = n;
+  uint64_t y = (x + 1) / 2;
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+  return x;
+}
+
+// Return floor(N^{1/3}) for N >= 0, by binary search.
+//
+//   N -- The integer whose cube root to take.
+//
+static int64_t lmo_icbrt(int64_t n) {
+  int64_t low = 0;
+  int64_t high = 2097152;  // 2^21, whose cube exceeds 2^63.
+  while (high - low > 1) {
+    int64_t mid = (low + high) / 2;
+    if (mid * mid * mid <= n) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Create the tables of MU, LPF, and PRIMES up to Y with a linear
+// sieve, and the table of \phi(V, PHI_C).  Aborts if allocation fails.
+//
+//   Y -- The largest integer to tabulate.
+//
+static lmo_tables_t* create_lmo_tables(int64_t y) {
+  lmo_tables_t *tables = (lmo_tables_t*) malloc(sizeof(lmo_tables_t));
+  if (NULL == tables) {
+    lmo_out_of_memory("the LMO tables");
+  }
+  tables->y = y;
+  tables->mu = (int8_t*) calloc(y + 1, sizeof(int8_t));
+  tables->lpf = (uint32_t*) calloc(y + 1, sizeof(uint32_t));
+  // There are at most Y/3 + 2 primes up to Y, as every prime other
+  // than 2 and 3 is 1 or 5 mod 6.
+  tables->primes = (uint32_t*) malloc((y / 3 + 3) * sizeof(uint32_t));
+  tables->pi = (uint32_t*) malloc((y + 1) * sizeof(uint32_t));
+  if (NULL == tables->mu || NULL == tables->lpf || NULL == tables->primes ||
+      NULL == tables->pi) {
+    lmo_out_of_memory("the LMO tables");
+  }
+
+  // Each composite N is visited once, as LPF[N] times the cofactor
+  // whose least prime factor is at least LPF[N].
+  int64_t num_primes = 0;
+  tables->primes[0] = 0;
+  tables->mu[1] = 1;
+  tables->lpf[1] = UINT32_MAX;
+  tables->pi[0] = 0;
+  tables->pi[1] = 0;
+  for (int64_t i = 2; i <= y; ++i) {
+    if (0 == tables->lpf[i]) {
+      tables->lpf[i] = (uint32_t) i;
+      tables->mu[i] = -1;
+      tables->primes[++num_primes] = (uint32_t) i;
+    }
+    tables->pi[i] = (uint32_t) num_primes;
+    for (int64_t j = 1; j <= num_primes; ++j) {
+      int64_t p = tables->primes[j];
+      if (p > tables->lpf[i] || i * p > y) {
+        break;
+      }
+      tables->lpf[i * p] = (uint32_t) p;
+      tables->mu[i * p] = p == tables->lpf[i] ? 0 : -tables->mu[i];
+    }
+  }
+  tables->num_primes = num_primes;
+
+  int count = 0;
+  for (int r = 0; r < PHI_PRIMORIAL; ++r) {
+    if (r > 0 && 0 != r % 2 && 0 != r % 3 && 0 != r % 5 && 0 != r % 7 &&
+        0 != r % 11 && 0 != r % 13) {
+      ++count;
+    }
+    tables->phi_table[r] = (uint16_t) count;
+  }
+  return tables;
+}
+
+// Free the LMO_TABLES_T structure.
+//
+//   TABLES -- the LMO_TABLES_T structure to free.
+//
+static void destroy_lmo_tables(lmo_tables_t *tables) {
+  free(tables->mu);
+  free(tables->lpf);
+  free(tables->primes);
+  free(tables->pi);
+  free(tables);
+}
+
+// Return \phi(V, PHI_C), the number of integers in [1, V] with no
+// prime factor up to 13.
+//
+//   TABLES -- The LMO tables.
+//
+//   V -- A nonnegative integer.
+//
+static inline int64_t phi_tiny(const lmo_tables_t *tables, int64_t v) {
+  return (v / PHI_PRIMORIAL) * PHI_TOTIENT
+      + tables->phi_table[v % PHI_PRIMORIAL];
+}
+
+// Sieve the odd integers of [LOW, HIGH) into SIEVE, where LOW is even
+// and entry I of SIEVE is LOW + 2*I + 1, using the odd primes
+// PRIMES[2..NUM_PRIMES].  If NEXT is not NULL, NEXT[J] holds the next
+// odd multiple of PRIMES[J] to mark, at least LOW, and is advanced
+// past HIGH; otherwise the first multiple is computed from LOW.
+//
+//   SIEVE -- Odd-only scratch sieve with room for (HIGH-LOW)/2 entries.
+//
+//   LOW, HIGH -- The segment to sieve.
+//
+//   PRIMES, NUM_PRIMES -- Sieving primes, including every prime P with
+//     P^2 < HIGH.
+//
+//   NEXT -- Per-prime next multiples, or NULL.
+//
+static void sieve_odd_segment(sieve_t *sieve, int64_t low, int64_t high,
+                              const uint32_t *primes, int64_t num_primes,
+                              int64_t *next) {
+  int64_t entries = (high - low) / 2;
+  init_sieve(sieve, entries);
+  if (0 == low) {
+    // 1 is not prime.
+    mark_composite(sieve, 0);
+  }
+  for (int64_t j = 2; j <= num_primes; ++j) {
+    int64_t p = primes[j];
+    if (p * p >= high) {
+      break;
+    }
+    int64_t k;
+    if (NULL != next) {
+      k = next[j];
+    } else {
+      k = low + (p - low % p) % p;
+      if (0 == (k & 1)) {
+        k += p;
+      }
+      if (k < p * p) {
+        k = p * p;
+      }
+    }
+    for ( ; k < high; k += 2 * p) {
+      mark_composite(sieve, (k - low) / 2);
+    }
+    if (NULL != next) {
+      next[j] = k;
+    }
+  }
+}
+
+// Initialize COUNTER to count the primes up to LIMIT.  Aborts if
+// allocation fails.
+//
+//   COUNTER -- The PRIME_COUNTER_T to initialize.
+//
+//   TABLES -- LMO tables whose primes include all primes up to
+//     \sqrt{LIMIT}.
+//
+static void prime_counter_init(prime_counter_t *counter,
+                               const lmo_tables_t *tables) {
+  counter->sieve = create_sieve(LMO_SEGMENT_ENTRIES);
+  counter->next = (int64_t*) malloc((tables->num_primes + 1) *
+                                    sizeof(int64_t));
+  if (NULL == counter->sieve || NULL == counter->next) {
+    lmo_out_of_memory("the P2 sieve");
+  }
+  counter->primes = tables->primes;
+  counter->num_primes = tables->num_primes;
+  for (int64_t j = 1; j <= tables->num_primes; ++j) {
+    counter->next[j] = (int64_t) tables->primes[j] * tables->primes[j];
+  }
+  counter->low = 0;
+  counter->high = 2 * LMO_SEGMENT_ENTRIES;
+  sieve_odd_segment(counter->sieve, counter->low, counter->high,
+                    counter->primes, counter->num_primes, counter->next);
+  // 2 is the only even prime.
+  counter->count_before = 1;
+  counter->word = 0;
+  counter->running = counter->count_before;
+}
+
+// Free the storage of COUNTER.
+//
+//   COUNTER -- The PRIME_COUNTER_T to free.
+//
+static void prime_counter_destroy(prime_counter_t *counter) {
+  destroy_sieve(counter->sieve);
+  free(counter->next);
+}
+
+// Return \pi(V).  Successive calls on COUNTER must pass nondecreasing
+// V >= 2.
+//
+//   COUNTER -- The PRIME_COUNTER_T to query.
+//
+//   V -- The integer up to which to count.
+//
+static int64_t prime_counter_pi(prime_counter_t *counter, int64_t v) {
+  while (v >= counter->high) {
+    counter->count_before +=
+        popcount_words(counter->sieve->primes,
+                       sieve_words(LMO_SEGMENT_ENTRIES));
+    counter->low = counter->high;
+    counter->high += 2 * LMO_SEGMENT_ENTRIES;
+    sieve_odd_segment(counter->sieve, counter->low, counter->high,
+                      counter->primes, counter->num_primes, counter->next);
+    counter->word = 0;
+    counter->running = counter->count_before;
+  }
+  if (v <= counter->low) {
+    return counter->count_before;
+  }
+
+  // Count the entries up to V, resuming from the words already
+  // counted.
+  int64_t index = (v - counter->low - 1) / 2;
+  int64_t word = index / BASE;
+  for ( ; counter->word < word; ++counter->word) {
+    counter->running += __builtin_popcountll(
+        counter->sieve->primes[counter->word]);
+  }
+  uint64_t mask = ~(uint64_t) 0 >> (BASE - 1 - index % BASE);
+  return counter->running +
+      __builtin_popcountll(counter->sieve->primes[word] & mask);
+}
+
+// Return the ordinary leaves of \phi(X, A), the sum of \mu(N) \phi(X/N,
+// PHI_C) over the N <= Y whose prime factors all exceed P_{PHI_C}.
+//
+//   X -- The argument of \pi.
+//
+//   TABLES -- The LMO tables up to Y.
+//
+static int64_t ordinary_leaves(int64_t x, const lmo_tables_t *tables) {
+  int64_t sum = 0;
+  uint32_t p_c = tables->primes[PHI_C];
+  for (int64_t n = 1; n <= tables->y; ++n) {
+    if (0 != tables->mu[n] && tables->lpf[n] > p_c) {
+      sum += tables->mu[n] * phi_tiny(tables, x / n);
+    }
+  }
+  return sum;
+}
+
+// Subtract 1 from entry I of the Fenwick tree TREE over NUM_ENTRIES
+// entries.
+//
+//   TREE -- The tree, indexed from 1.
+//
+//   NUM_ENTRIES -- The number of entries.
+//
+//   I -- The entry to decrement, indexed from 0.
+//
+static inline void fenwick_decrement(int32_t *tree, int64_t num_entries,
+                                     int64_t i) {
+  for (++i; i <= num_entries; i += i & -i) {
+    --tree[i];
+  }
+}
+
+// Return the sum of entries [0, I] of the Fenwick tree TREE.
+//
+//   TREE -- The tree, indexed from 1.
+//
+//   I -- The last entry to sum, indexed from 0.
+//
+static inline int64_t fenwick_sum(const int32_t *tree, int64_t i) {
+  int64_t sum = 0;
+  for (++i; i > 0; i -= i & -i) {
+    sum += tree[i];
+  }
+  return sum;
+}
+
+// Return the special leaves of \phi(X, A), the sum of -\mu(M)
+// \phi(X/(P_B*M), B-1) over PHI_C < B < A and Y/P_B < M <= Y with all
+// prime factors of M above P_B.  Sieves the odd integers of [1, Z],
+// where Z = X/Y, one segment at a time.
+//
+//   X -- The argument of \pi.
+//
+//   TABLES -- The LMO tables up to Y.
+//
+static int64_t special_leaves(int64_t x, const lmo_tables_t *tables) {
+  int64_t y = tables->y;
+  int64_t limit = x / y + 1;
+  int64_t num_primes = tables->num_primes;
+  const uint32_t *primes = tables->primes;
+  const int8_t *mu = tables->mu;
+  const uint32_t *lpf = tables->lpf;
+  const uint32_t *pi = tables->pi;
+
+  // UNSIEVED[I] records whether LOW + 2*I is still standing, and TREE
+  // counts the standing entries.  NEXT[B] is the next odd multiple of
+  // P_B to cross off, and PHI[B] is \phi(LOW-1, B-1).
+  uint8_t *unsieved = (uint8_t*) malloc(LMO_SEGMENT_ENTRIES);
+  int32_t *tree =
+      (int32_t*) malloc((LMO_SEGMENT_ENTRIES + 1) * sizeof(int32_t));
+  int64_t *next = (int64_t*) malloc((num_primes + 1) * sizeof(int64_t));
+  int64_t *phi = (int64_t*) calloc(num_primes + 1, sizeof(int64_t));
+  if (NULL == unsieved || NULL == tree || NULL == next || NULL == phi) {
+    lmo_out_of_memory("the special leaf sieve");
+  }
+  for (int64_t b = 1; b <= num_primes; ++b) {
+    next[b] = primes[b];
+  }
+
+  int64_t sum = 0;
+  for (int64_t low = 1; low < limit; low += 2 * LMO_SEGMENT_ENTRIES) {
+    int64_t high = low + 2 * LMO_SEGMENT_ENTRIES;
+    if (high > limit) {
+      high = limit;
+    }
+    int64_t entries = (high - low + 1) / 2;
+    memset(unsieved, 1, entries);
+
+    // The segment holds only odd integers, so crossing off starts with
+    // P_2 = 3.  The multiples of the first PHI_C primes are crossed off
+    // before the tree is built.
+    for (int64_t b = 2; b <= PHI_C; ++b) {
+      int64_t p = primes[b];
+      int64_t k = next[b];
+      for ( ; k < high; k += 2 * p) {
+        unsieved[(k - low) / 2] = 0;
+      }
+      next[b] = k;
+    }
+
+    // Build the tree in linear time: each node adds itself to its
+    // parent.
+    for (int64_t i = 1; i <= entries; ++i) {
+      tree[i] = unsieved[i - 1];
+    }
+    for (int64_t i = 1; i <= entries; ++i) {
+      int64_t parent = i + (i & -i);
+      if (parent <= entries) {
+        tree[parent] += tree[i];
+      }
+    }
+
+    for (int64_t b = PHI_C + 1; b < num_primes; ++b) {
+      int64_t p = primes[b];
+      int64_t x_p = x / p;
+      int64_t min_m = x_p / high > y / p ? x_p / high : y / p;
+      int64_t max_m = x_p / low < y ? x_p / low : y;
+
+      // No larger prime has leaves in this or any later segment.
+      if (p >= max_m) {
+        break;
+      }
+
+      // Sum the leaves P*M whose quotient X/(P*M) falls in [LOW, HIGH).
+      // Once P^2 > Y, every M <= Y with all prime factors above P is
+      // itself a prime above P, so only the primes need visiting.
+      if (p * p > y) {
+        int64_t min_prime = min_m > p ? min_m : p;
+        for (int64_t j = pi[max_m]; primes[j] > min_prime; --j) {
+          int64_t x_n = x_p / primes[j];
+          sum += phi[b] + fenwick_sum(tree, (x_n - low) / 2);
+        }
+      } else {
+        for (int64_t m = max_m; m > min_m; --m) {
+          if (0 != mu[m] && p < lpf[m]) {
+            int64_t x_n = x_p / m;
+            int64_t count = fenwick_sum(tree, (x_n - low) / 2);
+            sum -= mu[m] * (phi[b] + count);
+          }
+        }
+      }
+      phi[b] += fenwick_sum(tree, entries - 1);
+
+      // Cross off the odd multiples of P.
+      int64_t k = next[b];
+      for ( ; k < high; k += 2 * p) {
+        int64_t i = (k - low) / 2;
+        if (unsieved[i]) {
+          unsieved[i] = 0;
+          fenwick_decrement(tree, entries, i);
+        }
+      }
+      next[b] = k;
+    }
+  }
+
+  free(phi);
+  free(next);
+  free(tree);
+  free(unsieved);
+  return sum;
+}
+
+// Return P2(X, A), the number of integers in [1, X] that are the
+// product of two primes above Y, counted by pairs P <= Q.
+//
+//   X -- The argument of \pi.
+//
+//   TABLES -- The LMO tables up to Y.
+//
+static int64_t p2(int64_t x, const lmo_tables_t *tables) {
+  int64_t y = tables->y;
+  int64_t sqrt_x = lmo_isqrt(x);
+  if (sqrt_x <= y) {
+    return 0;
+  }
+
+  prime_counter_t counter;
+  prime_counter_init(&counter, tables);
+  sieve_t *block = create_sieve(LMO_SEGMENT_ENTRIES);
+  if (NULL == block) {
+    lmo_out_of_memory("the P2 sieve");
+  }
+
+  // Enumerate the primes P in (Y, \sqrt{X}] in decreasing order, one
+  // block at a time, so that X/P increases and COUNTER only moves
+  // forward.
+  int64_t sum = 0;
+  int64_t num_large = 0;
+  int64_t high = (sqrt_x + 2) & ~(int64_t) 1;
+  while (high > y + 1) {
+    // Entry I of BLOCK is LOW + 2*I + 1; LOW and HIGH are even.
+    int64_t low = high - 2 * LMO_SEGMENT_ENTRIES;
+    if (low < y + 1) {
+      low = (y + 1) & ~(int64_t) 1;
+    }
+    sieve_odd_segment(block, low, high, tables->primes, tables->num_primes,
+                      NULL);
+    for (int64_t w = sieve_words((high - low) / 2) - 1; w >= 0; --w) {
+      uint64_t bits = block->primes[w];
+      while (0 != bits) {
+        int bit = BASE - 1 - __builtin_clzll(bits);
+        bits &= ~((uint64_t) 1 << bit);
+        int64_t p = low + 2 * (BASE * w + bit) + 1;
+        if (p > y && p <= sqrt_x) {
+          sum += prime_counter_pi(&counter, x / p);
+          ++num_large;
+        }
+      }
+    }
+    high = low;
+  }
+
+  destroy_sieve(block);
+  prime_counter_destroy(&counter);
+
+  // The Ith of the NUM_LARGE primes, P_{A+I}, contributes -(A+I-1).
+  int64_t a = tables->num_primes;
+  return sum - num_large * a - num_large * (num_large - 1) / 2;
+}
+
+/*************************************************************************
+ * Definitions for methods in header file.
+ *************************************************************************/
+
+int64_t lmo_pi(int64_t x) {
+  if (x < 2) {
+    return 0;
+  }
+  if (x < LMO_MIN_X) {
+    lmo_tables_t *tables = create_lmo_tables(x);
+    int64_t count = tables->num_primes;
+    destroy_lmo_tables(tables);
+    return count;
+  }
+
+  // Y must be at least X^{1/3}, so that no integer up to X has three
+  // prime factors above Y, and at most \sqrt{X}.
+  int64_t y = LMO_ALPHA * lmo_icbrt(x);
+  int64_t sqrt_x = lmo_isqrt(x);
+  if (y > sqrt_x) {
+    y = sqrt_x;
+  }
+
+  lmo_tables_t *tables = create_lmo_tables(y);
+  int64_t phi = ordinary_leaves(x, tables) + special_leaves(x, tables);
+  int64_t count = phi + tables->num_primes - 1 - p2(x, tables);
+  destroy_lmo_tables(tables);
+  return count;
+}
+
+int64_t lmo_pi_cost(int64_t x) {
+  if (x < LMO_MIN_X) {
+    return x > 0 ? x : 0;
+  }
+  int64_t cbrt_x = lmo_icbrt(x);
+  return LMO_COST_FACTOR * cbrt_x * cbrt_x;
+}
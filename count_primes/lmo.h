@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files LMO.{H,C} declare and define LMO_PI(), which computes the
+ * prime-counting function \pi(X) combinatorially with the algorithm of
+ * Lagarias, Miller, and Odlyzko, in the formulation of Deleglise and
+ * Rivat, rather than by sieving all of [0, X].
+ *
+ * Let Y = ALPHA * X^{1/3}, let P_1 = 2, P_2 = 3, ... be the primes,
+ * let A = \pi(Y), and let \phi(V, B) be the number of integers in [1,
+ * V] with no prime factor among P_1, ..., P_B.  Every integer in (Y,
+ * X] with no prime factor up to Y is either a prime or the product of
+ * two primes above Y, since three such factors would exceed X.  Hence
+ *
+ *   \pi(X) = \phi(X, A) + A - 1 - P2(X, A),
+ *
+ * where P2(X, A) = \sum_{A < B <= \pi(\sqrt{X})} (\pi(X/P_B) - B + 1)
+ * counts those products.  P2 is computed by sieving [0, X/Y] with a
+ * segmented sieve and reading off \pi(X/P) for each prime P in (Y,
+ * \sqrt{X}].
+ *
+ * \phi(X, A) is expanded along the recurrence \phi(V, B) = \phi(V, B-1)
+ * - \phi(V/P_B, B-1) into a sum of _leaves_ \mu(N) \phi(X/N, B) over
+ * squarefree N.  The _ordinary_ leaves, N <= Y, are summed directly
+ * with \phi(V, C) for a small C, which is periodic in V with period
+ * P_1 * ... * P_C and read from a table.  The _special_ leaves, N = P_B
+ * * M > Y, need \phi(X/N, B-1) for X/N < X/Y.  They are summed by
+ * sieving [1, X/Y] one segment at a time, crossing off the multiples of
+ * P_1, P_2, ... in turn.  Just before the multiples of P_B are crossed
+ * off, the entries still standing in [1, V] number \phi(V, B-1), and a
+ * Fenwick tree over the segment answers each such count in O(log) time.
+ *
+ * Both the sieve of [1, X/Y] and the tables of \mu and least prime
+ * factors up to Y take O(X^{2/3}) time, up to logarithmic factors, and
+ * far less space, so LMO_PI() beats sieving an interval once the
+ * interval is much longer than X^{2/3}.
+ *************************************************************************/
+
+#ifndef INCLUDED_LMO_DOT_H
+#define INCLUDED_LMO_DOT_H
+
+#include <inttypes.h>
+
+// Return \pi(X), the number of primes in [0, X].
+//
+//   X -- An integer less than 2^63.
+//
+int64_t lmo_pi(int64_t x);
+
+// Return an estimate of the running time of LMO_PI(X), expressed as
+// the number of integers that COUNT_PRIMES_IN_INTERVAL() sieves in the
+// same time.
+//
+//   X -- An integer less than 2^63.
+//
+int64_t lmo_pi_cost(int64_t x);
+
+#endif  // INCLUDED_LMO_DOT_H
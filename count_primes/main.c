@@ -33,34 +33,154 @@
  *
  * The MAIN() routine first invokes the PARSE_ARGUMENTS() helper
  * method to retrieve the START and LENGTH integers from the command
- * line arguments, and then it invokes COUNT_PRIMES_IN_INTERVAL() to
+ * line arguments, and then it invokes COUNT_PRIMES_IN_INTERVAL_CTX() to
  * count the number of primes in [START, START+LENGTH).  The MAIN()
- * function times the execution time of COUNT_PRIMES_IN_INTERVAL() and
- * prints the result of COUNT_PRIMES_IN_INTERVAL() and its running
- * time to STDOUT upon completion.
+ * function times the execution time of COUNT_PRIMES_IN_INTERVAL_CTX()
+ * and prints the result of COUNT_PRIMES_IN_INTERVAL_CTX() and its
+ * running time to STDOUT upon completion.
+ *
+ * The --threads flag sets the number of worker threads of the context
+ * among which the interval is split.
+ *
+ * The --segment-bytes flag overrides the size of the segments into
+ * which the interval is split, which otherwise matches the L2 cache.
+ *
+ * The --algorithm flag selects whether the interval is sieved or its
+ * primes are counted as \pi(START+LENGTH-1) - \pi(START-1) with the
+ * Lagarias-Miller-Odlyzko algorithm, or each integer is tested with the
+ * Miller-Rabin test.  By default, the fastest one is picked from START
+ * and LENGTH.
+ *
+ * The --max-memory flag gives the context a budget of bytes, which
+ * shrinks its segments and the number of threads sieving at once to fit
+ * (see CREATE_COUNT_PRIMES_CTX()), and prints the peak resident set
+ * size of the process once done.  The budget is best effort: a single
+ * thread sieves even if it does not fit, with a warning.
+ *
+ * The --isa flag restricts the word kernels of KERNELS.H to their
+ * variants for the given instruction set, in place of the best ones
+ * the CPU supports, and prints the instruction set they use, so that
+ * the variants can be benchmarked against each other in one binary.
+ *
+ * The --build-cache flag writes the sieving primes that any interval
+ * needs to a cache file and exits.  The --cache flag then maps that
+ * file instead of listing the sieving primes for the interval, which
+ * dominates the running time of short intervals near 2^63.
+ *
+ * The --build-pi-table flag writes a table of \pi(x) at every multiple
+ * of the --pi-step (2^32 by default) up to a given end, and exits.  The
+ * --pi-table flag then loads that table, so that only the partial
+ * blocks at the ends of each interval are counted.
+ *
+ * The --resume flag saves the progress of the count to a state file
+ * about every ten seconds with COUNT_PRIMES_IN_INTERVAL_RESUMABLE(),
+ * and if the file already exists, resumes the count it records.
+ *
+ * The --batch flag reads many intervals, one per line, from a file or
+ * STDIN and prints the count of each, listing the sieving primes only
+ * once for all of them.
+ *
+ * The --print and --output flags write the primes of the interval
+ * themselves, found with ENUMERATE_PRIMES_IN_INTERVAL_CTX(), as decimal
+ * text to STDOUT or as binary 64-bit integers to a file, respectively.
+ * With --delta, each prime is written as its difference from the
+ * previous one, which in binary takes one or two bytes as a base-128
+ * varint rather than eight.
+ *
+ * The --stats flag also gathers statistics of the primes of the
+ * interval with PRIME_STATS_IN_INTERVAL_CTX() -- the numbers of twin
+ * primes and other prime K-tuplets, the largest gap between consecutive
+ * primes, and a histogram of the gaps -- in the same pass that counts
+ * them, and prints them after the count.
+ *
+ * The --modulus flag also counts the primes of the interval in each
+ * residue class modulo the given integer, with
+ * COUNT_PRIMES_BY_RESIDUE_CTX(), in the same pass that counts them.
+ *
+ * The --serve flag instead runs a daemon that answers queries from
+ * other processes over a Unix-domain socket, keeping the sieving primes
+ * in memory between queries (see SERVER.H).
  *
  * When the --verify flag is passed, the program checks the result of
  * COUNT_PRIMES_IN_INTERVAL() by counting the number of primes in
- * [START, START+LENGTH) using trial division.  Trial division tests
- * the primality of an integer P by checking each integer D in [2,
- * \sqrt{P}] to see if D divides P.
+ * [START, START+LENGTH) using the deterministic Miller-Rabin test on
+ * each integer (see TRIALDIV.H).
  *************************************************************************/
 
 // FASTTIME.H has to be included very early, so just include it first.
 #include <fasttime.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/resource.h>
 
-// COUNT_PRIMES.{H,C} declares and defines COUNT_PRIMES_IN_INTERVAL().
+// COUNT_PRIMES.{H,C} declares and defines COUNT_PRIMES_IN_INTERVAL_CTX()
+// and the COUNT_PRIMES_CTX_T it counts with.
 #include "./count_primes.h"
+// KERNELS.{H,C} declares and defines KERNELS_SELECT_ISA(), which the
+// "--isa" flag overrides the selected kernel variants with.
+#include "./kernels.h"
+// PI_TABLE.H defines the default step of the "--build-pi-table" flag.
+#include "./pi_table.h"
 // TRIALDIV.{H,C} declares and defines
-// TRIALDIV_COUNT_PRIMES_IN_INTERVAL(), which is used to verify the
+// MILLER_RABIN_COUNT_PRIMES_IN_INTERVAL(), which is used to verify the
 // result of COUNT_PRIMES_IN_INTERVAL() when the "--verify" flag is
 // passed.
 #include "./trialdiv.h"
+// SERVER.{H,C} declares and defines SERVE_QUERIES(), which runs the
+// daemon of the "--serve" flag.
+#include "./server.h"
+
+// Settings parsed from the command line by PARSE_ARGUMENTS().
+typedef struct options_t {
+  // The interval [START, START+LENGTH) to count.
+  int64_t start;
+  int64_t length;
+  // Whether to verify each count with the Miller-Rabin test.
+  bool verify;
+  // The number of worker threads to use.
+  int num_threads;
+  // The memory budget of the context in bytes, or 0 for none.
+  int64_t max_memory;
+  // Whether the instruction set of the kernels was set with --isa.
+  bool isa;
+  // Path of the cache file to write, or NULL.
+  const char *build_cache;
+  // Path of the table of \pi(x) to write, or NULL, and the step and end
+  // of the table.
+  const char *build_pi_table;
+  int64_t pi_step;
+  int64_t pi_end;
+  // Path of the file of intervals to count, "-" for STDIN, or NULL.
+  const char *batch;
+  // Path of the socket on which to serve queries, or NULL.
+  const char *serve;
+  // Whether to print the primes to STDOUT, and the path of the binary
+  // file to write them to, or NULL.
+  bool print;
+  const char *output;
+  // Whether to write the differences between consecutive primes.
+  bool delta;
+  // Whether to gather and print statistics of the primes.
+  bool stats;
+  // Modulus by whose residue classes to count the primes, or 0.
+  int64_t modulus;
+  // Path of the state file from which to resume the count, or NULL.
+  const char *resume;
+} options_t;
+
+// Destination of the primes written by WRITE_PRIMES(): FILE, as binary
+// if BINARY is true, and as differences if DELTA is true, in which case
+// PREVIOUS is the last prime written, initially 0.
+typedef struct prime_writer_t {
+  FILE *file;
+  bool binary;
+  bool delta;
+  int64_t previous;
+} prime_writer_t;
 
 /**************************************************************************
  * Helper methods for MAIN
@@ -72,59 +192,527 @@
 //
 static void print_usage(const char *program_name) {
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "%s [--verify] <start> <length>\n", program_name);
+  fprintf(stderr,
+          "%s [--verify] [--threads <n>] [--segment-bytes <bytes>]\n"
+          "\t[--max-memory <bytes>] [--isa generic|popcnt|avx2|avx512]\n"
+          "\t[--algorithm lmo|sieve|miller-rabin|auto] [--cache <path>]\n"
+          "\t[--pi-table <path>] [--resume <path>]\n"
+          "\t[--print | --output <file>] [--delta] [--stats]\n"
+          "\t[--modulus <q>] <start> <length>\n",
+          program_name);
   fprintf(stderr,
           "\tPrint the number of primes in [<start>,<start>+<length>), where <start>,\n"
           "\t<length>, and <start>+<length> are all nonnegative integers less than\n"
           "\t2^{63}.\n");
-  fprintf(stderr, "\t--verify: Verify the result using trial division.\n");
+  fprintf(stderr,
+          "\t--verify: Verify the result by testing each integer with the\n"
+          "\t\tMiller-Rabin test.\n");
+  fprintf(stderr,
+          "\t--threads <n>: Sieve with <n> worker threads (default 1).  A\n"
+          "\t\tnonpositive <n> uses one thread per online processor.\n");
+  fprintf(stderr,
+          "\t--segment-bytes <bytes>: Sieve segments of <bytes> bytes of bitmap\n"
+          "\t\t(default: the L2 cache size).\n");
+  fprintf(stderr,
+          "\t--max-memory <bytes>: Shrink the segments and sieve with fewer\n"
+          "\t\tthreads to try to use at most about <bytes> bytes, warn if\n"
+          "\t\teven one thread may not fit, and print the peak resident\n"
+          "\t\tset size.\n");
+  fprintf(stderr,
+          "\t--isa generic|popcnt|avx2|avx512: Use the kernel variants for\n"
+          "\t\tthe given instruction set, or the best one below it that\n"
+          "\t\tthe CPU supports, and print which (default: the best).\n");
+  fprintf(stderr,
+          "\t--algorithm lmo|sieve|miller-rabin|auto: Count with the\n"
+          "\t\tLagarias-Miller-Odlyzko prime-counting algorithm, with a\n"
+          "\t\tsegmented sieve, by testing each integer, or with whichever\n"
+          "\t\tis expected to be fastest (default auto).\n");
+  fprintf(stderr,
+          "\t--cache <path>: Read the sieving primes from the cache file\n"
+          "\t\t<path> written by --build-cache.\n");
+  fprintf(stderr,
+          "\t--pi-table <path>: Look up the number of primes in whole blocks\n"
+          "\t\tof the table file <path> written by --build-pi-table.\n");
+  fprintf(stderr,
+          "\t--resume <path>: Save the progress of the count to the state\n"
+          "\t\tfile <path> about every ten seconds, and resume the count\n"
+          "\t\tsaved there, if any.\n");
+  fprintf(stderr,
+          "\t--print: Print the primes to STDOUT, one per line, and the\n"
+          "\t\tcount to STDERR.\n");
+  fprintf(stderr,
+          "\t--output <file>: Write the primes to <file> as native-endian\n"
+          "\t\t64-bit unsigned integers.\n");
+  fprintf(stderr,
+          "\t--stats: Also print the numbers of twin primes and prime\n"
+          "\t\tk-tuplets, the largest gap between consecutive primes, and\n"
+          "\t\ta histogram of the gaps.\n");
+  fprintf(stderr,
+          "\t--modulus <q>: Also print the number of primes congruent to\n"
+          "\t\teach residue modulo <q>, one \"<residue> <count>\" per line.\n");
+  fprintf(stderr,
+          "\t--delta: Write the difference between each prime and the one\n"
+          "\t\tbefore it, as unsigned LEB128 varints with --output.  The\n"
+          "\t\tfirst prime is written as is.\n");
+  fprintf(stderr,
+          "%s [options] --batch <file>\n"
+          "\tRead one \"<start> <length>\" interval per line of <file>, or of\n"
+          "\tSTDIN if <file> is -, and print \"<start> <length> <count>\" for\n"
+          "\teach.  Takes the same options as above.\n",
+          program_name);
+  fprintf(stderr,
+          "%s [options] --serve <path>\n"
+          "\tAnswer \"count <start> <length>\" queries, one per line, from\n"
+          "\tclients of the Unix-domain socket <path> until killed, answering\n"
+          "\tone query per online processor at once.  --threads applies to\n"
+          "\teach query.\n",
+          program_name);
+  fprintf(stderr, "%s --build-cache <path>\n", program_name);
+  fprintf(stderr,
+          "\tWrite the sieving primes of every interval below 2^{63} to the\n"
+          "\tcache file <path>.\n");
+  fprintf(stderr,
+          "%s [--threads <n>] [--pi-step <step>] --build-pi-table <path> <end>\n",
+          program_name);
+  fprintf(stderr,
+          "\tWrite the number of primes less than each multiple of <step>\n"
+          "\t(default 2^{32}, at most 2^{33}) up to <end> to the table file\n"
+          "\t<path>.\n");
   fprintf(stderr, "%s -h\n", program_name);
   fprintf(stderr, "\tPrint this help message.\n");
 }
 
 // Helper function of MAIN() to parse the command-line arguments.
 //
-//   START -- Pointer to variable storing low endpoint of input
-//     interval.
-//
-//   LENGTH -- Pointer to variable storing the input interval's
-//     length.
-//
-//   VERIFY -- Pointer to storage for boolean flag dictating whether
-//     to verify result.
+//   OPTIONS -- Pointer to storage for the parsed settings.
 //
 //   ARGC, ARGV -- Command-line arguments originally passed to MAIN.
 //
-static void parse_arguments(int64_t *start, int64_t *length, bool *verify,
-                            int argc, char *argv[]) {
+static void parse_arguments(options_t *options, int argc, char *argv[]) {
   if (argc < 2) {
     // Print usage and quit
     print_usage(argv[0]);
     exit(1);
   }
 
-  *verify = false;
-  *start = 0;
-  *length = 0;
+  options->verify = false;
+  options->num_threads = 1;
+  options->max_memory = 0;
+  options->isa = false;
+  options->build_cache = NULL;
+  options->build_pi_table = NULL;
+  options->pi_step = PI_TABLE_DEFAULT_STEP;
+  options->pi_end = 0;
+  options->batch = NULL;
+  options->serve = NULL;
+  options->print = false;
+  options->output = NULL;
+  options->delta = false;
+  options->stats = false;
+  options->modulus = 0;
+  options->resume = NULL;
+  options->start = 0;
+  options->length = 0;
 
   for (int i = 1; i < argc; ++i) {
     if (strcmp(argv[i], "-h") == 0) {
       print_usage(argv[0]);
       exit(1);
     } else if (strcmp(argv[i], "--verify") == 0) {
-      *verify = true;
+      options->verify = true;
+    } else if (strcmp(argv[i], "--print") == 0) {
+      options->print = true;
+    } else if (strcmp(argv[i], "--delta") == 0) {
+      options->delta = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options->stats = true;
+    } else if (strcmp(argv[i], "--modulus") == 0) {
+      ++i;
+      if (argc == i || atol(argv[i]) < 1) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->modulus = atol(argv[i]);
+    } else if (strcmp(argv[i], "--resume") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->resume = argv[i];
+    } else if (strcmp(argv[i], "--output") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->output = argv[i];
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->num_threads = atoi(argv[i]);
+    } else if (strcmp(argv[i], "--max-memory") == 0) {
+      ++i;
+      if (argc == i || atol(argv[i]) < 1) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->max_memory = atol(argv[i]);
+    } else if (strcmp(argv[i], "--isa") == 0) {
+      ++i;
+      if (argc == i || !kernels_select_isa(argv[i])) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->isa = true;
+    } else if (strcmp(argv[i], "--segment-bytes") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      count_primes_set_segment_bytes(atol(argv[i]));
+    } else if (strcmp(argv[i], "--build-cache") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->build_cache = argv[i];
+    } else if (strcmp(argv[i], "--build-pi-table") == 0) {
+      i += 2;
+      if (argc <= i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->build_pi_table = argv[i - 1];
+      options->pi_end = atol(argv[i]);
+    } else if (strcmp(argv[i], "--pi-step") == 0) {
+      ++i;
+      if (argc == i || atol(argv[i]) < 1 ||
+          atol(argv[i]) > PI_TABLE_MAX_STEP) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->pi_step = atol(argv[i]);
+    } else if (strcmp(argv[i], "--pi-table") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      if (!count_primes_open_pi_table(argv[i])) {
+        fprintf(stderr, "Failed to open the table file %s.\nAborting.\n",
+                argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->batch = argv[i];
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      options->serve = argv[i];
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      if (!count_primes_open_cache(argv[i])) {
+        fprintf(stderr, "Failed to open the cache file %s.\nAborting.\n",
+                argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--algorithm") == 0) {
+      ++i;
+      if (argc == i) {
+        print_usage(argv[0]);
+        exit(1);
+      }
+      if (strcmp(argv[i], "lmo") == 0) {
+        count_primes_set_algorithm(COUNT_PRIMES_LMO);
+      } else if (strcmp(argv[i], "sieve") == 0) {
+        count_primes_set_algorithm(COUNT_PRIMES_SIEVE);
+      } else if (strcmp(argv[i], "miller-rabin") == 0) {
+        count_primes_set_algorithm(COUNT_PRIMES_MILLER_RABIN);
+      } else if (strcmp(argv[i], "auto") == 0) {
+        count_primes_set_algorithm(COUNT_PRIMES_AUTO);
+      } else {
+        print_usage(argv[0]);
+        exit(1);
+      }
     } else {
-      *start = atol(argv[i]);
+      options->start = atol(argv[i]);
       ++i;
       if (argc == i) {
         print_usage(argv[0]);
         exit(1);
       }
-      *length = atol(argv[i]);
+      options->length = atol(argv[i]);
+    }
+  }
+}
+
+
+// Return a new context that counts with the number of worker threads
+// and within the memory budget of OPTIONS.  Exits if it cannot be
+// created.
+//
+//   OPTIONS -- The parsed settings.
+//
+static count_primes_ctx_t* create_ctx(const options_t *options) {
+  count_primes_ctx_t *ctx = create_count_primes_ctx(options->num_threads,
+                                                    options->max_memory);
+  if (NULL == ctx) {
+    fprintf(stderr, "Failed to create a counting context.\nAborting.\n");
+    exit(1);
+  }
+  return ctx;
+}
+
+// Callback of ENUMERATE_PRIMES_IN_INTERVAL_CTX() that writes the
+// NUM_PRIMES primes at PRIMES to the PRIME_WRITER_T DATA.  Returns false
+// if writing fails.
+static bool write_primes(const int64_t *primes, int64_t num_primes,
+                         void *data) {
+  prime_writer_t *writer = (prime_writer_t*) data;
+  if (writer->binary && !writer->delta) {
+    return fwrite(primes, sizeof(int64_t), num_primes, writer->file)
+        == (size_t) num_primes;
+  }
+
+  // Encode into a local buffer, which holds one value of at most 20
+  // bytes per prime, and write it in one go.
+  char buffer[32 * 64];
+  int64_t size = 0;
+  for (int64_t i = 0; i < num_primes; ++i) {
+    uint64_t value = primes[i];
+    if (writer->delta) {
+      value -= writer->previous;
+      writer->previous = primes[i];
+    }
+    if (writer->binary) {
+      // Unsigned LEB128: 7 bits per byte, low bits first, with the high
+      // bit set on all but the last byte.
+      while (value >= 0x80) {
+        buffer[size++] = (char) (value | 0x80);
+        value >>= 7;
+      }
+      buffer[size++] = (char) value;
+    } else {
+      // Decimal digits, written backwards and then reversed.
+      int64_t first = size;
+      do {
+        buffer[size++] = (char) ('0' + value % 10);
+        value /= 10;
+      } while (0 != value);
+      for (int64_t j = size - 1; first < j; ++first, --j) {
+        char digit = buffer[first];
+        buffer[first] = buffer[j];
+        buffer[j] = digit;
+      }
+      buffer[size++] = '\n';
+    }
+    if (size > (int64_t) sizeof(buffer) - 32 || i == num_primes - 1) {
+      if (fwrite(buffer, 1, size, writer->file) != (size_t) size) {
+        return false;
+      }
+      size = 0;
+    }
+  }
+  return true;
+}
+
+// Write the primes in [START, START+LENGTH) as set by OPTIONS, with
+// the context CTX, and return their number.  Exits if they cannot be
+// written.
+//
+//   CTX -- The context with which to sieve.
+//
+//   OPTIONS -- The parsed command-line settings.
+//
+static int64_t write_interval(count_primes_ctx_t *ctx,
+                              const options_t *options) {
+  prime_writer_t writer;
+  writer.file = stdout;
+  writer.binary = NULL != options->output;
+  writer.delta = options->delta;
+  writer.previous = 0;
+  if (writer.binary) {
+    writer.file = fopen(options->output, "wb");
+    if (NULL == writer.file) {
+      fprintf(stderr, "Failed to open %s.\nAborting.\n", options->output);
+      exit(1);
     }
   }
+  int64_t num_primes = enumerate_primes_in_interval_ctx(
+      ctx, options->start, options->length, write_primes, &writer);
+  if (0 != ferror(writer.file) || 0 != fflush(writer.file) ||
+      (writer.binary && 0 != fclose(writer.file))) {
+    fprintf(stderr, "Failed to write the primes.\nAborting.\n");
+    exit(1);
+  }
+  return num_primes;
 }
 
+// Print STATS, the statistics of the primes in an interval, to STDOUT.
+//
+//   STATS -- The statistics to print.
+//
+static void print_stats(const prime_stats_t *stats) {
+  static const char *TUPLET_NAMES[PRIME_STATS_MAX_TUPLET + 1] = {
+    NULL, NULL, "twin primes", "prime triplets", "prime quadruplets",
+    "prime quintuplets", "prime sextuplets"
+  };
+  for (int k = 2; k <= PRIME_STATS_MAX_TUPLET; ++k) {
+    printf("%s: %"PRId64"\n", TUPLET_NAMES[k], stats->tuplets[k]);
+  }
+  if (stats->num_primes > 0) {
+    printf("first prime: %"PRId64"\n", stats->first_prime);
+    printf("last prime: %"PRId64"\n", stats->last_prime);
+  }
+  if (stats->num_primes > 1) {
+    printf("max gap: %"PRId64" after %"PRId64"\n",
+           stats->max_gap, stats->max_gap_start);
+  }
+  printf("gap histogram (gap count):\n");
+  for (int64_t i = 0; i < PRIME_STATS_HISTOGRAM_SIZE; ++i) {
+    if (0 != stats->gap_histogram[i]) {
+      printf("%"PRId64"%s %"PRId64"\n", i > 0 ? 2 * i : 1,
+             i == PRIME_STATS_HISTOGRAM_SIZE - 1 ? "+" : "",
+             stats->gap_histogram[i]);
+    }
+  }
+}
+
+// Check NUM_PRIMES, the number of primes counted in [START,
+// START+LENGTH), using the Miller-Rabin test to count the number of
+// primes in [START, START+LENGTH).  Exits if the counts differ.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+//   NUM_PRIMES -- The count to check.
+//
+static void verify_count(int64_t start, int64_t length, int64_t num_primes) {
+  int64_t verify_num_primes
+      = miller_rabin_count_primes_in_interval(start, length);
+  if (verify_num_primes != num_primes) {
+    fprintf(stderr,
+            "verify_num_primes (%"PRId64") does not match num_primes (%"PRId64")\n",
+            verify_num_primes, num_primes);
+    exit(1);
+  }
+}
+
+// Count the primes in each interval listed in the file OPTIONS->BATCH,
+// or STDIN if it is "-", and print one line "<start> <length> <count>"
+// per interval to STDOUT.  Each line of the file holds the START and
+// LENGTH of an interval, optionally followed by other fields, which are
+// ignored; blank lines and lines starting with '#' are skipped.  All
+// intervals are read before any is counted, so that the sieving primes
+// are listed once, for the largest endpoint of an interval that is
+// sieved.  Aborts if an interval is malformed or does not lie in [0,
+// 2^63).
+//
+//   OPTIONS -- The parsed command-line settings.
+//
+static void run_batch(const options_t *options) {
+  FILE *file = stdin;
+  if (0 != strcmp(options->batch, "-")) {
+    file = fopen(options->batch, "r");
+    if (NULL == file) {
+      fprintf(stderr, "Failed to open %s.\nAborting.\n", options->batch);
+      exit(1);
+    }
+  }
+
+  // Read the intervals, as pairs of START and LENGTH.
+  int64_t num_intervals = 0;
+  int64_t capacity = 64;
+  int64_t *intervals = (int64_t*) malloc(2 * capacity * sizeof(int64_t));
+  char line[256];
+  for (int64_t line_number = 1; NULL != intervals &&
+           NULL != fgets(line, sizeof(line), file); ++line_number) {
+    const char *text = line + strspn(line, " \t\r\n");
+    if ('\0' == *text || '#' == *text) {
+      continue;
+    }
+    char *start_end, *length_end;
+    errno = 0;
+    int64_t start = strtoll(text, &start_end, 10);
+    int64_t length = strtoll(start_end, &length_end, 10);
+    if (start_end == text || length_end == start_end) {
+      fprintf(stderr, "Malformed interval on line %"PRId64" of %s.\nAborting.\n",
+              line_number, options->batch);
+      exit(1);
+    }
+    if (0 != errno || start < 0 || length < 0 || start > INT64_MAX - length) {
+      fprintf(stderr, "Interval on line %"PRId64" of %s exceeds [0, 2^63-1].\n"
+              "Aborting.\n", line_number, options->batch);
+      exit(1);
+    }
+    if (num_intervals == capacity) {
+      capacity *= 2;
+      intervals = (int64_t*) realloc(intervals,
+                                     2 * capacity * sizeof(int64_t));
+      if (NULL == intervals) {
+        break;
+      }
+    }
+    intervals[2 * num_intervals] = start;
+    intervals[2 * num_intervals + 1] = length;
+    ++num_intervals;
+  }
+  if (NULL == intervals) {
+    fprintf(stderr, "Failed to allocate the intervals.\nAborting.\n");
+    exit(1);
+  }
+  if (stdin != file) {
+    fclose(file);
+  }
+
+  // Reserve only the endpoints of the intervals that are sieved, since
+  // the others need no sieving primes.
+  fasttime_t begin = gettime();
+  count_primes_ctx_t *ctx = create_ctx(options);
+  int64_t max_end = 0;
+  for (int64_t i = 0; i < num_intervals; ++i) {
+    int64_t end = count_primes_sieved_end(ctx, intervals[2 * i],
+                                          intervals[2 * i + 1]);
+    if (end > max_end) {
+      max_end = end;
+    }
+  }
+  count_primes_reserve(max_end);
+  for (int64_t i = 0; i < num_intervals; ++i) {
+    int64_t start = intervals[2 * i];
+    int64_t length = intervals[2 * i + 1];
+    int64_t num_primes = count_primes_in_interval_ctx(ctx, start, length);
+    printf("%"PRId64" %"PRId64" %"PRId64"\n", start, length, num_primes);
+    fflush(stdout);
+    if (options->verify) {
+      verify_count(start, length, num_primes);
+    }
+  }
+  fasttime_t end = gettime();
+  destroy_count_primes_ctx(ctx);
+  fprintf(stderr, "%"PRId64" intervals counted in %f seconds\n",
+          num_intervals, tdiff(begin, end));
+  free(intervals);
+}
 
 /**************************************************************************
  * MAIN()
@@ -132,37 +720,132 @@ static void parse_arguments(int64_t *start, int64_t *length, bool *verify,
 
 int main(int argc, char *argv[]) {
   int64_t num_primes;
-  int64_t start, length;
-  bool verify;
+  options_t options;
 
   // Parse the command-line arguments
-  parse_arguments(&start, &length, &verify, argc, argv);
+  parse_arguments(&options, argc, argv);
+  int64_t start = options.start;
+  int64_t length = options.length;
+
+  // If "--build-cache" is specified, just write the cache file.
+  if (NULL != options.build_cache) {
+    fasttime_t begin = gettime();
+    if (!count_primes_build_cache(options.build_cache)) {
+      fprintf(stderr, "Failed to write the cache file %s.\nAborting.\n",
+              options.build_cache);
+      exit(1);
+    }
+    fasttime_t end = gettime();
+    printf("Wrote the cache file %s\n", options.build_cache);
+    printf("%f seconds\n", tdiff(begin, end));
+    return 0;
+  }
+
+  // If "--build-pi-table" is specified, just write the table file.
+  if (NULL != options.build_pi_table) {
+    fasttime_t begin = gettime();
+    if (!count_primes_build_pi_table(options.build_pi_table, options.pi_step,
+                                     options.pi_end, options.num_threads)) {
+      fprintf(stderr, "Failed to write the table file %s.\nAborting.\n",
+              options.build_pi_table);
+      exit(1);
+    }
+    fasttime_t end = gettime();
+    printf("Wrote the table file %s\n", options.build_pi_table);
+    printf("%f seconds\n", tdiff(begin, end));
+    return 0;
+  }
+
+  // If "--batch" is specified, count the intervals listed in the file.
+  if (NULL != options.batch) {
+    run_batch(&options);
+    return 0;
+  }
+
+  // If "--serve" is specified, answer queries until killed.
+  if (NULL != options.serve) {
+    if (!serve_queries(options.serve, 0, options.num_threads)) {
+      fprintf(stderr, "Failed to serve on %s.\nAborting.\n", options.serve);
+      exit(1);
+    }
+    return 0;
+  }
 
   // Get the start time
   fasttime_t begin = gettime();
-  // Count the primes in the specified interval
-  num_primes = count_primes_in_interval(start, length);
+  // Count the primes in the specified interval, or write them if
+  // "--print" or "--output" is specified.  "--modulus" and "--stats"
+  // each count them in a pass of their own.
+  count_primes_ctx_t *ctx = create_ctx(&options);
+  bool write = options.print || NULL != options.output;
+  prime_stats_t stats;
+  int64_t *residue_counts = NULL;
+  if (write) {
+    num_primes = write_interval(ctx, &options);
+  } else if (options.modulus > 0 || options.stats) {
+    num_primes = 0;
+    if (options.modulus > 0) {
+      residue_counts = (int64_t*) malloc(options.modulus * sizeof(int64_t));
+      if (NULL == residue_counts) {
+        fprintf(stderr, "Failed to allocate %"PRId64" counts.\nAborting.\n",
+                options.modulus);
+        exit(1);
+      }
+      num_primes = count_primes_by_residue_ctx(ctx, start, length,
+                                               options.modulus,
+                                               residue_counts);
+    }
+    if (options.stats) {
+      prime_stats_in_interval_ctx(ctx, start, length, &stats);
+      num_primes = stats.num_primes;
+    }
+  } else if (NULL != options.resume) {
+    num_primes = count_primes_in_interval_resumable(ctx, start, length,
+                                                    options.resume);
+    if (num_primes < 0) {
+      fprintf(stderr, "Failed to resume from or save to the state file %s."
+              "\nAborting.\n", options.resume);
+      exit(1);
+    }
+  } else {
+    num_primes = count_primes_in_interval_ctx(ctx, start, length);
+  }
+  destroy_count_primes_ctx(ctx);
   // Get the end time
   fasttime_t end = gettime();
 
-  // Print the number of primes found and the running time.
-  printf("%"PRId64" primes found in [%"PRId64", %"PRId64")\n",
-         num_primes, start, start + length);
+  // Print the number of primes found and the running time, to STDERR
+  // if the primes themselves went to STDOUT.
+  FILE *report = options.print && NULL == options.output ? stderr : stdout;
+  fprintf(report, "%"PRId64" primes found in [%"PRId64", %"PRId64")\n",
+          num_primes, start, start + length);
 
-  printf("%f seconds\n", tdiff(begin, end));
+  fprintf(report, "%f seconds\n", tdiff(begin, end));
+  if (options.max_memory > 0) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // Linux reports the peak resident set size in kilobytes.
+    fprintf(report, "%ld KB peak resident set size\n", usage.ru_maxrss);
+  }
+  if (options.isa) {
+    fprintf(report, "%s kernels\n", kernels_isa_name());
+  }
+
+  if (NULL != residue_counts) {
+    for (int64_t r = 0; r < options.modulus; ++r) {
+      printf("%"PRId64" %"PRId64"\n", r, residue_counts[r]);
+    }
+    free(residue_counts);
+  }
+  if (options.stats && !write) {
+    print_stats(&stats);
+  }
 
   // If "--verify" is specified, check the result of
-  // COUNT_PIMRES_IN_INTERVAL() using trial division to count the
+  // COUNT_PIMRES_IN_INTERVAL() using the Miller-Rabin test to count the
   // number of primes in [START, START+LENGTH).
-  if (verify) {
-    int64_t trialdiv_num_primes
-        = trialdiv_count_primes_in_interval((uint64_t)start, (uint64_t)length);
-    if (trialdiv_num_primes != num_primes) {
-      fprintf(stderr,
-              "trialdiv_num_primes (%"PRId64") does not match num_primes (%"PRId64")\n",
-              trialdiv_num_primes, num_primes);
-      exit(1);
-    }
+  if (options.verify) {
+    verify_count(start, length, num_primes);
   }
 
   return 0;
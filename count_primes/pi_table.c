@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include "./pi_table.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Identifies a file written by WRITE_PI_TABLE(), and the version of its
+// layout.
+#define PI_TABLE_MAGIC "PITABLE1"
+
+// Header of a file written by WRITE_PI_TABLE(), which is followed by
+// NUM_BLOCKS 32-bit counts, the number of primes in each block.
+typedef struct pi_table_header_t {
+  char magic[8];
+  int64_t step;
+  int64_t num_blocks;
+} pi_table_header_t;
+
+// Number of block counts written or read at once.
+#define PI_TABLE_CHUNK 4096
+
+pi_table_t* create_pi_table(int64_t step, int64_t num_blocks) {
+  if (step < 1 || step > PI_TABLE_MAX_STEP || num_blocks < 0 ||
+      num_blocks > INT64_MAX / step) {
+    return NULL;
+  }
+  pi_table_t *table = (pi_table_t*) malloc(sizeof(pi_table_t));
+  if (NULL == table) {
+    return NULL;
+  }
+  table->step = step;
+  table->num_blocks = num_blocks;
+  table->pi = (int64_t*) calloc(num_blocks + 1, sizeof(int64_t));
+  if (NULL == table->pi) {
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+void destroy_pi_table(pi_table_t *table) {
+  free(table->pi);
+  free(table);
+}
+
+bool write_pi_table(const pi_table_t *table, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (NULL == file) {
+    return false;
+  }
+  pi_table_header_t header;
+  memcpy(header.magic, PI_TABLE_MAGIC, sizeof(header.magic));
+  header.step = table->step;
+  header.num_blocks = table->num_blocks;
+  bool ok = 1 == fwrite(&header, sizeof(header), 1, file);
+  uint32_t counts[PI_TABLE_CHUNK];
+  for (int64_t k = 0; ok && k < table->num_blocks; k += PI_TABLE_CHUNK) {
+    int64_t n = table->num_blocks - k;
+    n = n < PI_TABLE_CHUNK ? n : PI_TABLE_CHUNK;
+    for (int64_t i = 0; ok && i < n; ++i) {
+      int64_t count = table->pi[k + i + 1] - table->pi[k + i];
+      ok = count >= 0 && count <= UINT32_MAX;
+      counts[i] = (uint32_t) count;
+    }
+    ok = ok && (size_t) n == fwrite(counts, sizeof(uint32_t), n, file);
+  }
+  return 0 == fclose(file) && ok;
+}
+
+pi_table_t* read_pi_table(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (NULL == file) {
+    return NULL;
+  }
+
+  // Reject files that are not tables.
+  pi_table_header_t header;
+  pi_table_t *table = NULL;
+  if (1 == fread(&header, sizeof(header), 1, file) &&
+      0 == memcmp(header.magic, PI_TABLE_MAGIC, sizeof(header.magic))) {
+    table = create_pi_table(header.step, header.num_blocks);
+  }
+  if (NULL == table) {
+    fclose(file);
+    return NULL;
+  }
+
+  // Sum the counts of the blocks into \pi(x), rejecting truncated
+  // files.
+  uint32_t counts[PI_TABLE_CHUNK];
+  bool ok = true;
+  for (int64_t k = 0; ok && k < table->num_blocks; k += PI_TABLE_CHUNK) {
+    int64_t n = table->num_blocks - k;
+    n = n < PI_TABLE_CHUNK ? n : PI_TABLE_CHUNK;
+    ok = (size_t) n == fread(counts, sizeof(uint32_t), n, file);
+    for (int64_t i = 0; ok && i < n; ++i) {
+      table->pi[k + i + 1] = table->pi[k + i] + counts[i];
+    }
+  }
+  // Nor should anything follow the last block.
+  ok = ok && EOF == fgetc(file);
+  fclose(file);
+  if (!ok) {
+    destroy_pi_table(table);
+    return NULL;
+  }
+  return table;
+}
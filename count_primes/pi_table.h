@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files PI_TABLE.{H,C} declare and define the PI_TABLE_T data type,
+ * a table of the prime-counting function \pi(x) at the checkpoints
+ * x = 0, STEP, 2*STEP, ..., NUM_BLOCKS*STEP.  With such a table, the
+ * number of primes in any interval that spans whole blocks
+ * [K*STEP, (K+1)*STEP) is a difference of two entries, so that only the
+ * partial blocks at either end of the interval need to be counted.
+ *
+ * A table is saved to a file with WRITE_PI_TABLE() and loaded with
+ * READ_PI_TABLE().  To keep the file compact, it holds the number of
+ * primes in each block as a 32-bit integer rather than each \pi(x) in
+ * full, which STEP <= PI_TABLE_MAX_STEP guarantees to fit: by the
+ * Brun-Titchmarsh inequality of Montgomery and Vaughan, \pi(x+y) -
+ * \pi(x) < 2y / \ln y for y > 1, so a block of 2^33 integers holds
+ * fewer than 7.6 * 10^8 primes, well below 2^32.  WRITE_PI_TABLE()
+ * checks each count all the same.  The table of \pi(x) up to 2^50 with
+ * the default step of 2^32 thus takes 1MB.  READ_PI_TABLE() sums the
+ * blocks back into \pi(x) as it loads them.
+ *************************************************************************/
+
+#ifndef INCLUDED_PI_TABLE_DOT_H
+#define INCLUDED_PI_TABLE_DOT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The default distance between checkpoints of a PI_TABLE_T.
+#define PI_TABLE_DEFAULT_STEP (INT64_C(1) << 32)
+
+// The largest distance between checkpoints allowed, for which the
+// number of primes in each block provably fits in 32 bits.
+#define PI_TABLE_MAX_STEP (INT64_C(1) << 33)
+
+// The prime-counting function at multiples of STEP: PI[K] is the number
+// of primes less than K*STEP, for K = 0, 1, ..., NUM_BLOCKS.
+typedef struct pi_table_t {
+  int64_t step;
+  int64_t num_blocks;
+  int64_t *pi;
+} pi_table_t;
+
+// Create a PI_TABLE_T of NUM_BLOCKS blocks of STEP integers each, whose
+// entries are all zero.  Returns a pointer to the newly created
+// PI_TABLE_T, or NULL if allocation fails.
+//
+//   STEP -- The distance between checkpoints, in [1, PI_TABLE_MAX_STEP].
+//
+//   NUM_BLOCKS -- The number of blocks, such that NUM_BLOCKS*STEP is
+//   at most 2^63-1.
+//
+pi_table_t* create_pi_table(int64_t step, int64_t num_blocks);
+
+// Free the PI_TABLE_T structure.
+//
+//   TABLE -- the PI_TABLE_T structure to free.
+//
+void destroy_pi_table(pi_table_t *table);
+
+// Write TABLE to the file PATH, replacing any existing file.  Returns
+// false if the file cannot be written, or if the count of a block does
+// not fit in 32 bits.
+//
+//   TABLE -- The PI_TABLE_T to write.
+//
+//   PATH -- The path of the file to write.
+//
+bool write_pi_table(const pi_table_t *table, const char *path);
+
+// Load the PI_TABLE_T stored in the file PATH by WRITE_PI_TABLE().
+// Returns a pointer to the loaded PI_TABLE_T, or NULL if the file
+// cannot be read or does not hold a table.
+//
+//   PATH -- The path of the file to load.
+//
+pi_table_t* read_pi_table(const char *path);
+
+#endif  // INCLUDED_PI_TABLE_DOT_H
@@ -0,0 +1,341 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// We need _POSIX_C_SOURCE to pick up MMAP() and FSTAT().
+#define _POSIX_C_SOURCE 200809L
+
+#include "./prime_list.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./sieve.h"
+#include "./trialdiv.h"
+
+// Number of bytes of the wheel-30 sieve used for each segment of
+// CREATE_PRIME_LIST(), i.e., 30 integers per byte.  Small enough that
+// the segment stays in the L1 cache while it is crossed off.
+#define PRIME_LIST_SEGMENT_BYTES (1 << 15)
+
+// Initial capacity, in primes, of the gaps of a PRIME_LIST_T.
+#define PRIME_LIST_INITIAL_CAPACITY (1 << 16)
+
+// Identifies a file written by WRITE_PRIME_LIST(), and its format
+// version.
+static const char PRIME_LIST_MAGIC[8] = { 'P', 'R', 'I', 'M', 'E', 'G', 'A', '1' };
+
+// Header of a file written by WRITE_PRIME_LIST(), followed by the
+// COUNT gaps of the list.
+typedef struct prime_list_header_t {
+  char magic[8];
+  int64_t limit;
+  int64_t count;
+} prime_list_header_t;
+
+// A prime P >= 7 used to sieve the segments of CREATE_PRIME_LIST(),
+// with its next multiple NEXT to mark and the wheel position WHEEL of
+// NEXT/P, such that NEXT/P + WHEEL30_GAPS[WHEEL] is the following
+// multiplier coprime to 30.
+typedef struct base_prime_t {
+  int64_t next;
+  uint32_t prime;
+  uint32_t wheel;
+} base_prime_t;
+
+// Find the primes in [0, UPPER_BOUND) with a basic prime sieve.
+// Returns a newly allocated wheel-30 sieve recording them, or NULL if
+// allocation fails; 2, 3, and 5 are not represented in it.
+//
+//   UPPER_BOUND -- The length of the sieve to create.
+//
+static wheel30_sieve_t* find_small_primes(int64_t upper_bound) {
+  wheel30_sieve_t *sieve = create_wheel30_sieve(upper_bound);
+  if (NULL == sieve) {
+    return NULL;
+  }
+
+  // The wheel-30 sieve does not represent multiples of 2, 3, or 5, so
+  // those are never marked.  Of the remaining integers, only 1 is
+  // not a prime or a multiple of a prime >= 7.
+  init_wheel30_sieve(sieve);
+  if (upper_bound > 1) {
+    wheel30_mark_composite(sieve, 1);
+  }
+
+  // Scan the integers I coprime to 30 with I^2 < UPPER_BOUND, stepping
+  // along the wheel from 7.
+  int w = 1;
+  for (int64_t i = 7; i * i < upper_bound; i += WHEEL30_GAPS[w], w = (w + 1) & 7) {
+    tbassert(trialdiv_prime_p(i) == wheel30_prime_p(sieve, i),
+             "Incorrect primality recorded for %"PRId64"\n", i);
+
+    // Skip any I marked as composite
+    if (!wheel30_prime_p(sieve, i)) {
+      continue;
+    }
+
+    // At this point, I is prime.  Mark the multiples I*K as composite
+    // for the K coprime to 30 with K >= I; every other multiple of I
+    // is either unrepresented or has a smaller prime factor.
+    int k_w = w;
+    for (int64_t temp = i * i; temp < upper_bound;
+         temp += i * WHEEL30_GAPS[k_w], k_w = (k_w + 1) & 7) {
+      wheel30_mark_composite(sieve, temp);
+    }
+  }
+  return sieve;
+}
+
+// Collect the primes P >= 7 with P^2 <= LIMIT into a newly allocated
+// array of BASE_PRIME_T, each starting from its first multiple to
+// mark, P^2.  Returns the array, or NULL if allocation fails, and
+// stores its length in NUM_BASE_PRIMES.
+//
+//   LIMIT -- The largest integer to be sieved.
+//
+//   NUM_BASE_PRIMES -- Pointer to storage for the array length.
+//
+static base_prime_t* collect_base_primes(int64_t limit,
+                                         int64_t *num_base_primes) {
+  int64_t root = 1;
+  while ((root + 1) * (root + 1) <= limit) {
+    ++root;
+  }
+  wheel30_sieve_t *sieve = find_small_primes(root + 1);
+  if (NULL == sieve) {
+    return NULL;
+  }
+
+  int64_t count = 0;
+  wheel30_cursor_t cursor;
+  wheel30_cursor_init(&cursor, sieve, 7);
+  while (wheel30_next_prime(&cursor, sieve) > 0) {
+    ++count;
+  }
+
+  base_prime_t *primes =
+      (base_prime_t*) malloc((count + 1) * sizeof(base_prime_t));
+  if (NULL != primes) {
+    wheel30_cursor_init(&cursor, sieve, 7);
+    for (int64_t i = 0; i < count; ++i) {
+      int64_t p = wheel30_next_prime(&cursor, sieve);
+      primes[i].prime = (uint32_t) p;
+      primes[i].next = p * p;
+      primes[i].wheel = WHEEL30_BIT[p % 30];
+    }
+    *num_base_primes = count;
+  }
+  destroy_wheel30_sieve(sieve);
+  return primes;
+}
+
+// Append the odd prime P to LIST, growing its gaps as needed.  Returns
+// false if allocation fails.
+//
+//   LIST -- The PRIME_LIST_T being built.
+//
+//   CAPACITY -- Pointer to the number of gaps allocated in LIST.
+//
+//   PREVIOUS -- Pointer to the last prime appended to LIST, or 1.
+//
+//   P -- The next odd prime, greater than *PREVIOUS.
+//
+static bool append_prime(prime_list_t *list, int64_t *capacity,
+                         int64_t *previous, int64_t p) {
+  if (list->count == *capacity) {
+    uint8_t *gaps = (uint8_t*) realloc(list->gaps, 2 * *capacity);
+    if (NULL == gaps) {
+      return false;
+    }
+    list->gaps = gaps;
+    *capacity *= 2;
+  }
+  list->gaps[list->count++] = (uint8_t) ((p - *previous) / 2);
+  *previous = p;
+  return true;
+}
+
+// Sieve [0, LIMIT] one segment at a time with BASE_PRIMES, and append
+// the primes found to LIST.  Returns false if allocation fails.
+//
+//   LIST -- The PRIME_LIST_T being built, initially empty.
+//
+//   CAPACITY -- Pointer to the number of gaps allocated in LIST.
+//
+//   BASE_PRIMES -- The primes P >= 7 with P^2 <= LIMIT.
+//
+//   NUM_BASE_PRIMES -- The length of BASE_PRIMES.
+//
+//   SEGMENT -- Scratch wheel-30 sieve of 30*PRIME_LIST_SEGMENT_BYTES
+//     integers.
+//
+static bool sieve_prime_list(prime_list_t *list, int64_t *capacity,
+                             base_prime_t *base_primes,
+                             int64_t num_base_primes,
+                             wheel30_sieve_t *segment) {
+  int64_t limit = list->limit;
+
+  // 3 and 5 are not represented in a wheel-30 sieve.
+  int64_t previous = 1;
+  for (int64_t p = 3; p <= 5 && p <= limit; p += 2) {
+    if (!append_prime(list, capacity, &previous, p)) {
+      return false;
+    }
+  }
+
+  int64_t segment_length = 30 * (int64_t) PRIME_LIST_SEGMENT_BYTES;
+  for (int64_t low = 0; low <= limit; low += segment_length) {
+    int64_t high = limit + 1 - low < segment_length
+        ? limit + 1 : low + segment_length;
+    segment->length = high - low;
+    init_wheel30_sieve(segment);
+    if (0 == low && high > 1) {
+      wheel30_mark_composite(segment, 1);
+    }
+
+    // Mark the multiples of each base prime in [LOW, HIGH), stepping
+    // along the wheel.  A prime only starts marking at P^2, so base
+    // primes are never marked themselves.
+    for (int64_t i = 0; i < num_base_primes; ++i) {
+      int64_t p = base_primes[i].prime;
+      int64_t next = base_primes[i].next;
+      uint32_t w = base_primes[i].wheel;
+      for ( ; next < high; next += p * WHEEL30_GAPS[w], w = (w + 1) & 7) {
+        wheel30_mark_composite(segment, next - low);
+      }
+      base_primes[i].next = next;
+      base_primes[i].wheel = w;
+    }
+
+    wheel30_cursor_t cursor;
+    wheel30_cursor_init(&cursor, segment, 0 == low ? 7 : 0);
+    for (int64_t p = wheel30_next_prime(&cursor, segment); p > 0;
+         p = wheel30_next_prime(&cursor, segment)) {
+      if (!append_prime(list, capacity, &previous, low + p)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+prime_list_t* create_prime_list(int64_t limit) {
+  prime_list_t *list = (prime_list_t*) malloc(sizeof(prime_list_t));
+  if (NULL == list) {
+    return NULL;
+  }
+  list->limit = limit;
+  list->count = 0;
+  list->mapping = NULL;
+  list->mapping_bytes = 0;
+  int64_t capacity = PRIME_LIST_INITIAL_CAPACITY;
+  list->gaps = (uint8_t*) malloc(capacity);
+
+  int64_t num_base_primes = 0;
+  base_prime_t *base_primes = collect_base_primes(limit, &num_base_primes);
+  wheel30_sieve_t *segment =
+      create_wheel30_sieve(30 * (int64_t) PRIME_LIST_SEGMENT_BYTES);
+
+  bool ok = NULL != list->gaps && NULL != base_primes && NULL != segment
+      && sieve_prime_list(list, &capacity, base_primes, num_base_primes,
+                          segment);
+
+  if (NULL != segment) {
+    destroy_wheel30_sieve(segment);
+  }
+  free(base_primes);
+  if (!ok) {
+    destroy_prime_list(list);
+    return NULL;
+  }
+
+  // Give back the unused capacity.
+  uint8_t *gaps =
+      (uint8_t*) realloc(list->gaps, list->count > 0 ? list->count : 1);
+  if (NULL != gaps) {
+    list->gaps = gaps;
+  }
+  return list;
+}
+
+void destroy_prime_list(prime_list_t *list) {
+  if (NULL != list->mapping) {
+    munmap(list->mapping, list->mapping_bytes);
+  } else {
+    free(list->gaps);
+  }
+  free(list);
+}
+
+bool write_prime_list(const prime_list_t *list, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (NULL == file) {
+    return false;
+  }
+  prime_list_header_t header;
+  memcpy(header.magic, PRIME_LIST_MAGIC, sizeof(header.magic));
+  header.limit = list->limit;
+  header.count = list->count;
+  bool ok = 1 == fwrite(&header, sizeof(header), 1, file)
+      && (size_t) list->count == fwrite(list->gaps, 1, list->count, file);
+  return 0 == fclose(file) && ok;
+}
+
+prime_list_t* map_prime_list(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (0 == fstat(fd, &st) && st.st_size >= (off_t) sizeof(prime_list_header_t)) {
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  // The mapping stays valid once the file is closed.
+  close(fd);
+  if (MAP_FAILED == mapping) {
+    return NULL;
+  }
+
+  // Reject files that are not prime lists or have been truncated.
+  const prime_list_header_t *header = (const prime_list_header_t*) mapping;
+  prime_list_t *list = NULL;
+  if (0 == memcmp(header->magic, PRIME_LIST_MAGIC, sizeof(header->magic)) &&
+      header->count >= 0 &&
+      (off_t) sizeof(prime_list_header_t) + header->count == st.st_size) {
+    list = (prime_list_t*) malloc(sizeof(prime_list_t));
+  }
+  if (NULL == list) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+  list->limit = header->limit;
+  list->count = header->count;
+  list->gaps = (uint8_t*) mapping + sizeof(prime_list_header_t);
+  list->mapping = mapping;
+  list->mapping_bytes = st.st_size;
+  return list;
+}
@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files PRIME_LIST.{H,C} declare and define the PRIME_LIST_T data
+ * type, a compact, read-only list of the odd primes up to some LIMIT,
+ * used as the sieving primes of a segmented sieve.
+ *
+ * Rather than storing each prime in full, a PRIME_LIST_T stores the
+ * gaps between consecutive odd primes, halved, one byte per prime.
+ * Gaps between consecutive odd primes are even, and no gap between
+ * primes below 2^32 exceeds 336, so every halved gap fits in a byte.
+ * The list of all primes up to \sqrt{2^63} therefore takes about 146MB
+ * rather than the 586MB of 32-bit integers, and walking it in order
+ * is a single add per prime, with no bitmap to scan.
+ *
+ * CREATE_PRIME_LIST() finds the primes with a segmented Sieve of
+ * Eratosthenes over wheel-30 segments small enough to stay in the L1
+ * cache, so that only the list itself grows with LIMIT.  The segments
+ * are crossed off by the primes up to \sqrt{LIMIT}, each starting from
+ * its square and stepping along the wheel.
+ *
+ * A list can also be saved to a file with WRITE_PRIME_LIST() and later
+ * loaded with MAP_PRIME_LIST(), which maps the file read-only instead
+ * of sieving, so that the operating system shares a single copy of the
+ * list among all processes that map it.
+ *
+ * A PRIME_LIST_CURSOR_T walks the list in increasing order.  The list
+ * itself is never modified once created, so any number of threads can
+ * walk the same list at once, each with its own cursor.
+ *************************************************************************/
+
+#ifndef INCLUDED_PRIME_LIST_DOT_H
+#define INCLUDED_PRIME_LIST_DOT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The odd primes P <= LIMIT, in increasing order.  GAPS[I] is half the
+// difference between the Ith prime and the one before it, where the
+// prime before 3 is taken to be 1.  If the list was loaded with
+// MAP_PRIME_LIST(), MAPPING is the read-only mapping of MAPPING_BYTES
+// bytes holding GAPS; otherwise MAPPING is NULL.
+typedef struct prime_list_t {
+  int64_t limit;
+  int64_t count;
+  uint8_t *gaps;
+  void *mapping;
+  size_t mapping_bytes;
+} prime_list_t;
+
+// Position within a PRIME_LIST_T: the index of the next prime to
+// return, and the prime before it.
+typedef struct prime_list_cursor_t {
+  int64_t index;
+  int64_t prime;
+} prime_list_cursor_t;
+
+// Create a PRIME_LIST_T of the odd primes P <= LIMIT.  Returns a
+// pointer to the newly created PRIME_LIST_T, or NULL if allocation
+// fails.
+//
+//   LIMIT -- The largest integer to consider, at most 2^32.
+//
+prime_list_t* create_prime_list(int64_t limit);
+
+// Free the PRIME_LIST_T structure, or unmap it if it was loaded with
+// MAP_PRIME_LIST().
+//
+//   LIST -- the PRIME_LIST_T structure to free.
+//
+void destroy_prime_list(prime_list_t *list);
+
+// Write LIST to the file PATH, replacing any existing file.  Returns
+// false if the file cannot be written.
+//
+//   LIST -- The PRIME_LIST_T to write.
+//
+//   PATH -- The path of the file to write.
+//
+bool write_prime_list(const prime_list_t *list, const char *path);
+
+// Load the PRIME_LIST_T stored in the file PATH by WRITE_PRIME_LIST(),
+// by mapping the file read-only.  Returns a pointer to the loaded
+// PRIME_LIST_T, or NULL if the file cannot be mapped or does not hold
+// a prime list.
+//
+//   PATH -- The path of the file to load.
+//
+prime_list_t* map_prime_list(const char *path);
+
+// Position CURSOR at the first prime of LIST.
+//
+//   CURSOR -- The cursor to initialize.
+//
+static inline void prime_list_cursor_init(prime_list_cursor_t *cursor) {
+  cursor->index = 0;
+  cursor->prime = 1;
+}
+
+// Return the next prime of LIST after CURSOR and advance CURSOR past
+// it, or return -1 if LIST is exhausted.
+//
+//   CURSOR -- A cursor initialized with PRIME_LIST_CURSOR_INIT().
+//
+//   LIST -- The PRIME_LIST_T that CURSOR walks.
+//
+static inline int64_t prime_list_next(prime_list_cursor_t *cursor,
+                                      const prime_list_t *list) {
+  if (cursor->index >= list->count) {
+    return -1;
+  }
+  cursor->prime += 2 * (int64_t) list->gaps[cursor->index++];
+  return cursor->prime;
+}
+
+#endif  // INCLUDED_PRIME_LIST_DOT_H
@@ -64,12 +64,12 @@ def process_testfile(testfile, executable, quiet, cloud):
 
             # Attempt to parse the next line of the test file as a test.
             # Format of test file for project 1:
-            # start    length    result
-            # (start, length, expected_count) = line.split()
+            # start    length    result    [count_primes options]
+            # (start, length, expected_count) = line.split()[:3]
             test_line = line.strip().split()
 
             # Check that line has expected format
-            if len(test_line) != 3:
+            if len(test_line) < 3:
                 sys.stderr.write("ALERT: Error parsing line \"" + line.strip() + "\".  Skipping.\n")
                 continue
 
@@ -77,6 +77,7 @@ def process_testfile(testfile, executable, quiet, cloud):
             start = test_line[0]
             length = test_line[1]
             expected_count = test_line[2]
+            options = test_line[3:]
             try:
                 long(start)
                 long(length)
@@ -110,7 +111,7 @@ def process_testfile(testfile, executable, quiet, cloud):
                 call_count_primes = []
             else:
                 call_count_primes = [lrun]
-            call_count_primes += [executable, start, length]
+            call_count_primes += [executable] + options + [start, length]
 
             # Prepare result line
             result = start + "\t" + length + "\t"
@@ -118,9 +119,9 @@ def process_testfile(testfile, executable, quiet, cloud):
             # Print the test being run
 	    if not quiet:
                 if cloud:
-                    sys.stdout.write("Running \"" + ' '.join([executable, start, length]) + "\" on Cloud\n")
+                    sys.stdout.write("Running \"" + ' '.join([executable] + options + [start, length]) + "\" on Cloud\n")
                 else:
-                    sys.stdout.write("Running \"" + ' '.join([executable, start, length]) + "\" on Lanka (use Ctrl-C Ctrl-C to terminate)\n")
+                    sys.stdout.write("Running \"" + ' '.join([executable] + options + [start, length]) + "\" on Lanka (use Ctrl-C Ctrl-C to terminate)\n")
 
             # Run the test
             cmd = subprocess.Popen(call_count_primes,
@@ -0,0 +1,444 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+// We need _POSIX_C_SOURCE to pick up the socket functions, POLL(),
+// CLOCK_GETTIME(), and DPRINTF().
+#define _POSIX_C_SOURCE 200809L
+
+#include "./server.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./count_primes.h"
+
+// Number of connections that may be open at once.  Further clients
+// wait in the listen backlog until one closes.
+#define SERVER_MAX_CONNECTIONS 1024
+
+// Number of clients that may wait in the listen backlog.
+#define SERVER_LISTEN_BACKLOG 64
+
+// Longest query line, including its newline, that a client may send.
+#define SERVER_LINE_BYTES 256
+
+// Seconds after which a connection with no query in progress that sent
+// nothing is closed, and after which a reply that cannot be sent is
+// given up on.
+#define SERVER_IDLE_SECONDS 60
+
+// An open connection of SERVE_QUERIES().  Only the polling thread
+// touches a connection while BUSY is false, and only the worker
+// answering its query while BUSY is true.
+typedef struct connection_t {
+  // The connected socket, or -1 if this slot is free.
+  int fd;
+  // Bytes received after the last query handed out, and their number.
+  char buffer[SERVER_LINE_BYTES];
+  int used;
+  // The query being answered, without its newline, and whether it was
+  // cut short for being longer than SERVER_LINE_BYTES.
+  char query[SERVER_LINE_BYTES];
+  bool overlong;
+  // Whether the rest of an overlong line is being discarded.
+  bool skipping;
+  // Whether a worker is answering QUERY.
+  bool busy;
+  // Whether the client closed its end, or its reply failed, so that
+  // the connection is closed once no query is in progress.
+  bool closing;
+  // When the connection last received a query or sent a reply.
+  time_t last_active;
+} connection_t;
+
+// Connections with a query waiting for a worker, as a ring buffer of
+// indices into the connections of SERVE_QUERIES().  Each connection
+// has at most one query in progress, so the queue never overflows.
+// LOCK guards the whole queue, and NONEMPTY signals its changes.
+typedef struct request_queue_t {
+  int requests[SERVER_MAX_CONNECTIONS];
+  int head;
+  int size;
+  pthread_mutex_t lock;
+  pthread_cond_t nonempty;
+} request_queue_t;
+
+// Arguments of each worker thread of SERVE_QUERIES().  A worker writes
+// the index of each connection it answered to the pipe DONE_FD, which
+// wakes up the polling thread.
+typedef struct server_worker_t {
+  request_queue_t *queue;
+  connection_t *connections;
+  int done_fd;
+  int num_threads;
+} server_worker_t;
+
+/**************************************************************************
+ * Helper methods
+ *************************************************************************/
+
+// Return the current time of the monotonic clock, in seconds.
+static time_t now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+// Append the connection INDEX to QUEUE.
+//
+//   QUEUE -- The queue of connections with a query waiting.
+//
+//   INDEX -- The index of the connection.
+//
+static void push_request(request_queue_t *queue, int index) {
+  pthread_mutex_lock(&queue->lock);
+  queue->requests[(queue->head + queue->size) % SERVER_MAX_CONNECTIONS] =
+      index;
+  ++queue->size;
+  pthread_cond_signal(&queue->nonempty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+// Remove and return the oldest connection in QUEUE, waiting for one if
+// it is empty.
+//
+//   QUEUE -- The queue of connections with a query waiting.
+//
+static int pop_request(request_queue_t *queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (0 == queue->size) {
+    pthread_cond_wait(&queue->nonempty, &queue->lock);
+  }
+  int index = queue->requests[queue->head];
+  queue->head = (queue->head + 1) % SERVER_MAX_CONNECTIONS;
+  --queue->size;
+  pthread_mutex_unlock(&queue->lock);
+  return index;
+}
+
+// Answer the query LINE on the connected socket FD.  Returns false if
+// the reply cannot be sent.
+//
+//   FD -- The connected socket.
+//
+//   LINE -- The query, without its newline.
+//
+//   CTX -- The context with which to count.
+//
+static bool answer_query(int fd, const char *line, count_primes_ctx_t *ctx) {
+  const char *text = line + strspn(line, " \t\r");
+  if (0 != strncmp(text, "count", 5) || NULL == strchr(" \t", text[5])) {
+    return dprintf(fd, "error unknown command\n") >= 0;
+  }
+  char *start_end, *length_end;
+  errno = 0;
+  int64_t start = strtoll(text + 5, &start_end, 10);
+  int64_t length = strtoll(start_end, &length_end, 10);
+  if (start_end == text + 5 || length_end == start_end || 0 != errno ||
+      '\0' != length_end[strspn(length_end, " \t\r")]) {
+    return dprintf(fd, "error expected: count <start> <length>\n") >= 0;
+  }
+  if (start < 0 || length < 0) {
+    return dprintf(fd, "error <start> and <length> must be nonnegative\n")
+        >= 0;
+  }
+  if (start > INT64_MAX - length) {
+    return dprintf(fd, "error <start>+<length> exceeds 2^63-1\n") >= 0;
+  }
+  int64_t num_primes = count_primes_in_interval_ctx(ctx, start, length);
+  return dprintf(fd, "%"PRId64"\n", num_primes) >= 0;
+}
+
+// Body of each worker thread of SERVE_QUERIES(): answer the queries in
+// the queue, one at a time, forever, with a context of its own whose
+// buffers stay warm from one query to the next.
+//
+//   ARG -- Pointer to the SERVER_WORKER_T of the thread.
+//
+static void* server_worker(void *arg) {
+  server_worker_t *worker = (server_worker_t*) arg;
+  count_primes_ctx_t *ctx = create_count_primes_ctx(worker->num_threads, 0);
+  if (NULL == ctx) {
+    fprintf(stderr, "Failed to create a counting context.\nAborting.\n");
+    exit(1);
+  }
+  while (true) {
+    int index = pop_request(worker->queue);
+    connection_t *connection = &worker->connections[index];
+    bool sent = connection->overlong
+        ? dprintf(connection->fd, "error line too long\n") >= 0
+        : answer_query(connection->fd, connection->query, ctx);
+    if (!sent) {
+      // Drop the queries left, so that the connection is closed.
+      connection->closing = true;
+      connection->used = 0;
+    }
+    // Hand the connection back to the polling thread.
+    if (write(worker->done_fd, &index, sizeof(index)) != sizeof(index)) {
+      perror("write");
+      fprintf(stderr, "Aborting.\n");
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+// Close CONNECTION and free its slot.
+static void close_connection(connection_t *connection) {
+  close(connection->fd);
+  connection->fd = -1;
+}
+
+// Hand the next query received on the connection INDEX, which has none
+// in progress, to the workers, if a whole line of it has arrived.  If
+// not, and the client is gone, close the connection, handing out its
+// last query first if it did not end with a newline.
+//
+//   CONNECTIONS -- The connections of SERVE_QUERIES().
+//
+//   INDEX -- The index of the connection.
+//
+//   QUEUE -- The queue of connections with a query waiting.
+//
+static void advance_connection(connection_t *connections, int index,
+                               request_queue_t *queue) {
+  connection_t *connection = &connections[index];
+  char *newline = memchr(connection->buffer, '\n', connection->used);
+  int length = NULL != newline ? newline - connection->buffer
+      : connection->used;
+  connection->overlong = false;
+  if (NULL == newline && connection->used == SERVER_LINE_BYTES) {
+    // The line does not fit; reply with an error and discard the rest.
+    connection->overlong = true;
+    connection->skipping = true;
+    connection->used = 0;
+  } else if (NULL != newline || (connection->closing && length > 0)) {
+    memcpy(connection->query, connection->buffer, length);
+    connection->query[length] = '\0';
+    if (NULL != newline) {
+      ++length;
+    }
+    connection->used -= length;
+    memmove(connection->buffer, connection->buffer + length,
+            connection->used);
+  } else {
+    if (connection->closing) {
+      close_connection(connection);
+    }
+    return;
+  }
+  connection->busy = true;
+  push_request(queue, index);
+}
+
+// Read what the client of CONNECTION sent into its buffer, discarding
+// the rest of an overlong line, and mark it as closing if the client
+// closed its end.
+static void receive(connection_t *connection) {
+  ssize_t received = read(connection->fd,
+                          connection->buffer + connection->used,
+                          SERVER_LINE_BYTES - connection->used);
+  if (received < 0 && (EINTR == errno || EAGAIN == errno)) {
+    return;
+  }
+  if (received <= 0) {
+    connection->closing = true;
+    return;
+  }
+  connection->last_active = now_seconds();
+  if (connection->skipping) {
+    char *data = connection->buffer + connection->used;
+    char *newline = memchr(data, '\n', received);
+    if (NULL == newline) {
+      return;
+    }
+    connection->skipping = false;
+    received -= newline + 1 - data;
+    memmove(data, newline + 1, received);
+  }
+  connection->used += received;
+}
+
+/**************************************************************************
+ * Definitions for methods in header file.
+ *************************************************************************/
+
+bool serve_queries(const char *path, int num_workers, int num_threads) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "The socket path %s is too long.\n", path);
+    return false;
+  }
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  // Any query may reach 2^63, so list the sieving primes for every
+  // interval before accepting the first client.
+  count_primes_prepare(INT64_MAX);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    perror("socket");
+    return false;
+  }
+  // Replace the socket of an earlier daemon that did not clean up.
+  unlink(path);
+  if (0 != bind(listener, (struct sockaddr*) &address, sizeof(address)) ||
+      0 != listen(listener, SERVER_LISTEN_BACKLOG)) {
+    perror(path);
+    close(listener);
+    return false;
+  }
+  int done_pipe[2];
+  if (0 != pipe(done_pipe)) {
+    perror("pipe");
+    close(listener);
+    return false;
+  }
+
+  // A client that hangs up before reading its reply must not kill the
+  // daemon; DPRINTF() then just fails with EPIPE.
+  signal(SIGPIPE, SIG_IGN);
+
+  static connection_t connections[SERVER_MAX_CONNECTIONS];
+  for (int i = 0; i < SERVER_MAX_CONNECTIONS; ++i) {
+    connections[i].fd = -1;
+  }
+  int num_connections = 0;
+
+  if (num_workers <= 0) {
+    num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  request_queue_t queue;
+  queue.head = 0;
+  queue.size = 0;
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.nonempty, NULL);
+  server_worker_t worker = { &queue, connections, done_pipe[1], num_threads };
+  for (int i = 0; i < num_workers; ++i) {
+    pthread_t thread;
+    if (0 != pthread_create(&thread, NULL, server_worker, &worker)) {
+      fprintf(stderr, "Failed to create a server thread.\nAborting.\n");
+      exit(1);
+    }
+    pthread_detach(thread);
+  }
+
+  fprintf(stderr, "Serving queries on %s with %d workers\n",
+          path, num_workers);
+  // Poll the pipe of answered connections, the listener while there is
+  // room for another connection, and the connections with no query in
+  // progress, waking up every second to close the idle ones.
+  static struct pollfd fds[SERVER_MAX_CONNECTIONS + 2];
+  static int polled[SERVER_MAX_CONNECTIONS];
+  while (true) {
+    fds[0].fd = done_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = num_connections < SERVER_MAX_CONNECTIONS ? listener : -1;
+    fds[1].events = POLLIN;
+    int num_polled = 0;
+    time_t now = now_seconds();
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; ++i) {
+      connection_t *connection = &connections[i];
+      if (connection->fd < 0 || connection->busy) {
+        continue;
+      }
+      if (now - connection->last_active >= SERVER_IDLE_SECONDS) {
+        close_connection(connection);
+        --num_connections;
+        continue;
+      }
+      fds[num_polled + 2].fd = connection->fd;
+      fds[num_polled + 2].events = POLLIN;
+      polled[num_polled++] = i;
+    }
+    if (poll(fds, num_polled + 2, 1000) < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      perror("poll");
+      fprintf(stderr, "Aborting.\n");
+      exit(1);
+    }
+
+    for (int i = 0; i < num_polled; ++i) {
+      if (0 != fds[i + 2].revents) {
+        connection_t *connection = &connections[polled[i]];
+        receive(connection);
+        advance_connection(connections, polled[i], &queue);
+        num_connections -= connection->fd < 0;
+      }
+    }
+
+    if (0 != fds[0].revents) {
+      int index;
+      if (read(done_pipe[0], &index, sizeof(index)) != sizeof(index)) {
+        perror("read");
+        fprintf(stderr, "Aborting.\n");
+        exit(1);
+      }
+      connection_t *connection = &connections[index];
+      connection->busy = false;
+      connection->last_active = now_seconds();
+      advance_connection(connections, index, &queue);
+      num_connections -= connection->fd < 0;
+    }
+
+    if (0 != fds[1].revents) {
+      int fd = accept(listener, NULL, NULL);
+      if (fd < 0) {
+        if (EINTR == errno || ECONNABORTED == errno) {
+          continue;
+        }
+        perror("accept");
+        fprintf(stderr, "Aborting.\n");
+        exit(1);
+      }
+      // Give up on replies that the client does not read.
+      struct timeval timeout = { SERVER_IDLE_SECONDS, 0 };
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      int slot = 0;
+      while (connections[slot].fd >= 0) {
+        ++slot;
+      }
+      connection_t *connection = &connections[slot];
+      connection->fd = fd;
+      connection->used = 0;
+      connection->skipping = false;
+      connection->busy = false;
+      connection->closing = false;
+      connection->last_active = now_seconds();
+      ++num_connections;
+    }
+  }
+}
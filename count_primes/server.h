@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2014 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/**************************************************************************
+ * The files SERVER.{H,C} declare and define SERVE_QUERIES(), which
+ * runs COUNT_PRIMES as a long-running daemon answering queries over a
+ * local (Unix-domain) stream socket.
+ *
+ * A one-shot COUNT_PRIMES process spends most of the time of a short
+ * interval near 2^63 listing its sieving primes.  The daemon instead
+ * lists them once, at startup, for the largest interval it may be asked
+ * about, and answers every query with the same list.  Starting the
+ * daemon with --cache maps the list from a cache file instead, so that
+ * it starts at once.
+ *
+ * One thread polls the open connections and hands each query line it
+ * receives to a pool of worker threads, so that queries from different
+ * clients are counted concurrently, and clients that are idle or stay
+ * connected do not hold up the others.  A client sends one query per
+ * line and reads one reply per line, in order:
+ *
+ *   count <start> <length>   replies <count>, the number of primes in
+ *                            [<start>, <start>+<length>).
+ *   anything else            replies "error <message>".
+ *
+ * The connection ends when the client closes it, or after a minute
+ * without queries.
+ *************************************************************************/
+
+#ifndef INCLUDED_SERVER_DOT_H
+#define INCLUDED_SERVER_DOT_H
+
+#include <stdbool.h>
+
+// Listen on a Unix-domain socket at PATH, replacing any socket file
+// already there, and answer queries until the process is killed.
+// Returns false if the socket cannot be created.
+//
+//   PATH -- The path of the socket.
+//
+//   NUM_WORKERS -- The number of queries answered at once.  A
+//     nonpositive value answers one per online processor.
+//
+//   NUM_THREADS -- The number of worker threads with which each query
+//     is counted, as passed to CREATE_COUNT_PRIMES_CTX().
+//
+bool serve_queries(const char *path, int num_workers, int num_threads);
+
+#endif  // INCLUDED_SERVER_DOT_H
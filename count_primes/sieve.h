@@ -31,6 +31,16 @@
  * is an array P of h-l elements where P[i] is 1 if l+i is prime and 0
  * otherwise.
  *
+ * Two space-saving representations are layered on this idea.  An
+ * _odd-only_ sieve stores one entry per odd integer of its range,
+ * since no even integer other than 2 is prime; it reuses SIEVE_T, and
+ * ODD_SIEVE_LENGTH() and ODD_SIEVE_INDEX() translate between integers
+ * and entries.  A _wheel-30_ sieve, WHEEL30_SIEVE_T, stores only the
+ * integers coprime to 30 = 2*3*5, i.e., the 8 residues {1, 7, 11, 13,
+ * 17, 19, 23, 29} mod 30, so that one byte represents 30 integers.
+ * Compared to one bit per integer, these use 2x and 3.75x less memory,
+ * respectively.
+ *
  * See the documentation in SEGSIEVE.{H,C} for more on how the sieve
  * data structure is used to find primes in an interval.
  *************************************************************************/
@@ -43,28 +53,42 @@
 #include <stdlib.h>
 #include <tbassert.h>
 
-#define BASE 8
+#include "./alloc.h"
+
+#define BASE 64
 
 /**************************************************************************
  * Definition of SIEVE_T type.
  *************************************************************************/
 
-// The SIEVE_T struct consists of an integer LENGTH followed by an
-// array PRIMES of (length/8) 8-bits-integers. Each 8-bits-integer
-// represents 8 booleans. If SIEVE is a variable of type
-// SIEVE_T that represents a sieve for the interval [l,h), then
-// SIEVE.LENGTH = h-l and (I % BASE)th bit of SIEVE.PRIMES[I \ BASE]
-// 8-bits-integer is 1 if integer l+I is prime and 0 otherwise.
+// The SIEVE_T struct consists of an integer LENGTH and a pointer to an
+// array PRIMES of (length/64) 64-bits-integers. Each 64-bits-integer
+// represents 64 booleans, so that whole words can be filled and
+// counted at once. If SIEVE is a variable of type SIEVE_T that
+// represents a sieve for the interval [l,h), then SIEVE.LENGTH = h-l
+// and (I % BASE)th bit of SIEVE.PRIMES[I \ BASE] 64-bits-integer is 1
+// if integer l+I is prime and 0 otherwise.  Bits beyond LENGTH in the
+// last word are kept 0.  PRIMES is a buffer of its own, so that a
+// bitmap of whole huge pages takes no more of them.
 
 typedef struct sieve_t {
   int64_t length;
-  uint_fast8_t primes[0];
+  uint64_t *primes;
 } sieve_t;
 
 /**************************************************************************
  * Methods on the SIEVE_T type
  *************************************************************************/
 
+// Return the number of 64-bits-integers needed to store LENGTH
+// entries.
+//
+//   LENGTH -- The number of entries.
+//
+static inline int64_t sieve_words(int64_t length) {
+  return (length / BASE) + (length % BASE != 0);
+}
+
 // Create a SIEVE_T structure of LENGTH elements.  Returns a pointer
 // to the newly created SIEVE_T.
 //
@@ -74,13 +98,18 @@ typedef struct sieve_t {
 static inline sieve_t* create_sieve(int64_t length) {
   tbassert(length > 0,
            "bad length %ld\n", length);
-  int64_t bools_size = ((int64_t) length/BASE) + (length % BASE != 0);
-  sieve_t *sieve = (sieve_t*) malloc(sizeof(sieve_t) +
-                                    bools_size * sizeof(uint_fast8_t));
+  int64_t bools_size = sieve_words(length);
+  sieve_t *sieve = (sieve_t*) malloc(sizeof(sieve_t));
   /* tbassert(NULL != sieve, "malloc failed.\n"); */
-  if (NULL != sieve) {
-    sieve->length = length;
+  if (NULL == sieve) {
+    return NULL;
+  }
+  sieve->primes = (uint64_t*) alloc_buffer(bools_size * sizeof(uint64_t));
+  if (NULL == sieve->primes) {
+    free(sieve);
+    return NULL;
   }
+  sieve->length = length;
   return sieve;
 }
 
@@ -89,6 +118,7 @@ static inline sieve_t* create_sieve(int64_t length) {
 //   SIEVE -- the SIEVE_T structure to free.
 //
 static inline void destroy_sieve(sieve_t *sieve) {
+  free_buffer(sieve->primes, sieve_words(sieve->length) * sizeof(uint64_t));
   free(sieve);
 }
 
@@ -108,45 +138,7 @@ static inline void init_sieve(sieve_t *sieve, int64_t length) {
     sieve->primes[i] = ~0;
   }
   if (remains != 0) {
-    sieve->primes[length] = ((uint_fast8_t) 1 << remains) - 1;
-  }
-}
-
-// Initialize the SIEVE_T structure such that all odd bits are marked as composites.
-//
-//   SIEVE -- Pointer to the SIEVE_T structure to initialize.
-//
-// example 10101010
-static inline void init_sieve_with_odd_bits_off(sieve_t *sieve, int64_t length) {
-  int64_t remains = length % BASE;
-  length = length / BASE;
-
-  for (int64_t i = 0; i < length; ++i) {
-    // all even bits are marked as primes
-    // 170 = 10101010
-    sieve->primes[i] = 170;
-  }
-  if (remains != 0) {
-    sieve->primes[length] = 170 & (((uint_fast8_t) 1 << remains) - 1);
-  }
-}
-
-// Initialize the SIEVE_T structure such that all even bits are marked as composites.
-//
-//   SIEVE -- Pointer to the SIEVE_T structure to initialize.
-//
-// example 01010101
-static inline void init_sieve_with_even_bits_off(sieve_t *sieve, int64_t length) {
-  int64_t remains = length % BASE;
-  length = length / BASE;
-
-  for (int64_t i = 0; i < length; ++i) {
-    // all even bits are marked as primes
-    // 170 = 10101010
-    sieve->primes[i] = 85;
-  }
-  if (remains != 0) {
-    sieve->primes[length] = 85 & (((uint_fast8_t) 1 << remains) - 1);
+    sieve->primes[length] = ((uint64_t) 1 << remains) - 1;
   }
 }
 
@@ -159,12 +151,12 @@ static inline void init_sieve_with_even_bits_off(sieve_t *sieve, int64_t length)
 static inline void mark_composite(sieve_t *sieve, int64_t i) {
   tbassert(i >= 0 && i < sieve->length,
            "Invalid index %"PRId64".\n", i);
-  // position of uint_fast8_t inside sieve->primes that stores boolean i
+  // position of uint64_t inside sieve->primes that stores boolean i
   int64_t pos = i / BASE;
-  // position of boolean i inside this uint_fast8_t
+  // position of boolean i inside this uint64_t
   int64_t remain = i % BASE;
   // set that bit off
-  sieve->primes[pos] &= ~((uint_fast8_t) 1 << remain);
+  sieve->primes[pos] &= ~((uint64_t) 1 << remain);
 }
 
 // Mark index I in SIEVE as prime.
@@ -176,12 +168,12 @@ static inline void mark_composite(sieve_t *sieve, int64_t i) {
 static inline void mark_prime(sieve_t *sieve, int64_t i) {
   tbassert(i >= 0 && i < sieve->length,
            "Invalid index %"PRId64".\n", i);
-  // position of uint_fast8_t inside sieve->primes that stores boolean i
+  // position of uint64_t inside sieve->primes that stores boolean i
   int64_t pos = i / BASE;
-  // position of boolean i inside this uint_fast8_t
+  // position of boolean i inside this uint64_t
   int64_t remain = i % BASE;
   // set that bit on
-  sieve->primes[pos] |= ((uint_fast8_t) 1 << remain);
+  sieve->primes[pos] |= ((uint64_t) 1 << remain);
 }
 
 // Returns whether index I corresponds to a prime.
@@ -193,11 +185,232 @@ static inline void mark_prime(sieve_t *sieve, int64_t i) {
 static inline bool prime_p(const sieve_t *sieve, int64_t i) {
   tbassert(i >= 0 && i < sieve->length,
            "Invalid index %"PRId64".\n", i);
-  // position of uint_fast8_t inside sieve->primes that stores boolean i
+  // position of uint64_t inside sieve->primes that stores boolean i
   int64_t pos = i / BASE;
   // position of boolean i inside this int64_t
   int64_t remain = i % BASE;
-  return sieve->primes[pos] & ((uint_fast8_t) 1 << remain);
+  return sieve->primes[pos] & ((uint64_t) 1 << remain);
+}
+
+/**************************************************************************
+ * Sieving primes
+ *************************************************************************/
+
+// A prime used to sieve the segments of an interval.  OFFSET is the
+// index, relative to the first entry of a segment, of the next
+// multiple of PRIME to mark as composite.  Both fit in 32 bits
+// because sieving primes are below 2^32 and segments have at most
+// 2^30 entries, so that OFFSET stays below 4 segments.
+typedef struct sieving_prime_t {
+  uint32_t prime;
+  uint32_t offset;
+} sieving_prime_t;
+
+// A sieving prime whose odd multiples K*PRIME are only crossed off for
+// K coprime to 30, as the others are multiples of 3 or 5.  OFFSET is
+// as in SIEVING_PRIME_T, and K of the multiple at OFFSET is congruent
+// to WHEEL30_RESIDUES[WHEEL] mod 30.
+typedef struct wheel_prime_t {
+  uint32_t prime;
+  uint32_t offset;
+  uint32_t wheel;
+} wheel_prime_t;
+
+/**************************************************************************
+ * Odd-only sieves
+ *************************************************************************/
+
+// Return the number of entries of an odd-only sieve representing the
+// odd integers in [START, START+LENGTH), where START >= 0.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+//
+static inline int64_t odd_sieve_length(int64_t start, int64_t length) {
+  return (start + length) / 2 - start / 2;
+}
+
+// Return the index of the odd integer N in an odd-only sieve whose
+// entry 0 represents the odd integer BASE <= N.
+//
+//   BASE -- The odd integer represented by entry 0.
+//
+//   N -- The odd integer to locate.
+//
+static inline int64_t odd_sieve_index(int64_t base, int64_t n) {
+  tbassert((base & 1) && (n & 1) && n >= base,
+           "Invalid base %"PRId64" or integer %"PRId64".\n", base, n);
+  return (n - base) >> 1;
+}
+
+/**************************************************************************
+ * Wheel-30 sieves
+ *************************************************************************/
+
+// The WHEEL30_SIEVE_T struct represents the interval [0, LENGTH).
+// Bit B of PRIMES[K] is 1 if 30*K + WHEEL30_RESIDUES[B] is prime and
+// 0 otherwise.  Integers divisible by 2, 3, or 5 are not represented,
+// so the primes 2, 3, and 5 must be handled by the caller.
+typedef struct wheel30_sieve_t {
+  int64_t length;
+  uint8_t primes[0];
+} wheel30_sieve_t;
+
+// The residues mod 30 that are coprime to 30, in increasing order.
+static const uint8_t WHEEL30_RESIDUES[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+// Bit position of each residue mod 30 within a byte of a
+// WHEEL30_SIEVE_T, or -1 if the residue is not coprime to 30.
+static const int8_t WHEEL30_BIT[30] = {
+  -1, 0, -1, -1, -1, -1, -1, 1, -1, -1,
+  -1, 2, -1, 3, -1, -1, -1, 4, -1, 5,
+  -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+
+// Distance from WHEEL30_RESIDUES[B] to the next integer coprime to
+// 30.
+static const uint8_t WHEEL30_GAPS[8] = { 6, 4, 2, 4, 2, 4, 6, 2 };
+
+// Return the bit index of N in a WHEEL30_SIEVE_T, or -1 if N is
+// divisible by 2, 3, or 5.
+//
+//   N -- A nonnegative integer.
+//
+static inline int64_t wheel30_index(int64_t n) {
+  int bit = WHEEL30_BIT[n % 30];
+  if (bit < 0) {
+    return -1;
+  }
+  return 8 * (n / 30) + bit;
+}
+
+// Create a WHEEL30_SIEVE_T representing [0, LENGTH).  Returns a
+// pointer to the newly created WHEEL30_SIEVE_T, or NULL if allocation
+// fails.
+//
+//   LENGTH -- The number of integers represented.
+//
+static inline wheel30_sieve_t* create_wheel30_sieve(int64_t length) {
+  tbassert(length > 0,
+           "bad length %ld\n", length);
+  int64_t bytes = length / 30 + 1;
+  wheel30_sieve_t *sieve =
+      (wheel30_sieve_t*) malloc(sizeof(wheel30_sieve_t) + bytes);
+  if (NULL != sieve) {
+    sieve->length = length;
+  }
+  return sieve;
+}
+
+// Free the WHEEL30_SIEVE_T structure.
+//
+//   SIEVE -- the WHEEL30_SIEVE_T structure to free.
+//
+static inline void destroy_wheel30_sieve(wheel30_sieve_t *sieve) {
+  free(sieve);
+}
+
+// Initialize the WHEEL30_SIEVE_T structure such that all represented
+// integers in [0, SIEVE->LENGTH) are marked as prime.
+//
+//   SIEVE -- Pointer to the WHEEL30_SIEVE_T structure to initialize.
+//
+static inline void init_wheel30_sieve(wheel30_sieve_t *sieve) {
+  int64_t bytes = sieve->length / 30;
+  for (int64_t i = 0; i < bytes; ++i) {
+    sieve->primes[i] = 0xff;
+  }
+  // Only the residues below LENGTH are represented in the last byte.
+  uint8_t last = 0;
+  for (int b = 0; b < 8; ++b) {
+    if (30 * bytes + WHEEL30_RESIDUES[b] < sieve->length) {
+      last |= (uint8_t) 1 << b;
+    }
+  }
+  sieve->primes[bytes] = last;
+}
+
+// Mark N in SIEVE as composite.
+//
+//   SIEVE -- The target WHEEL30_SIEVE_T to update.
+//
+//   N -- An integer in [0, SIEVE->LENGTH) coprime to 30.
+//
+static inline void wheel30_mark_composite(wheel30_sieve_t *sieve, int64_t n) {
+  tbassert(n >= 0 && n < sieve->length,
+           "Invalid integer %"PRId64".\n", n);
+  int bit = WHEEL30_BIT[n % 30];
+  tbassert(bit >= 0, "Integer %"PRId64" is not coprime to 30.\n", n);
+  sieve->primes[n / 30] &= ~((uint8_t) 1 << bit);
+}
+
+// Returns whether N is recorded as prime in SIEVE.  Integers divisible
+// by 2, 3, or 5 are reported as composite.
+//
+//   SIEVE -- The target WHEEL30_SIEVE_T to examine.
+//
+//   N -- An integer in [0, SIEVE->LENGTH).
+//
+static inline bool wheel30_prime_p(const wheel30_sieve_t *sieve, int64_t n) {
+  tbassert(n >= 0 && n < sieve->length,
+           "Invalid integer %"PRId64".\n", n);
+  int bit = WHEEL30_BIT[n % 30];
+  return bit >= 0 && (sieve->primes[n / 30] & ((uint8_t) 1 << bit));
+}
+
+// A position in a WHEEL30_SIEVE_T, used to enumerate the primes it
+// records in increasing order.  BITS holds the bits of PRIMES[BYTE]
+// not yet enumerated.
+typedef struct wheel30_cursor_t {
+  int64_t byte;
+  uint8_t bits;
+} wheel30_cursor_t;
+
+// Position CURSOR so that WHEEL30_NEXT_PRIME() returns the primes
+// recorded in SIEVE that are at least N.
+//
+//   CURSOR -- The cursor to initialize.
+//
+//   SIEVE -- The WHEEL30_SIEVE_T to enumerate.
+//
+//   N -- A nonnegative integer.
+//
+static inline void wheel30_cursor_init(wheel30_cursor_t *cursor,
+                                       const wheel30_sieve_t *sieve,
+                                       int64_t n) {
+  cursor->byte = n / 30;
+  cursor->bits = 0;
+  if (30 * cursor->byte < sieve->length) {
+    cursor->bits = sieve->primes[cursor->byte];
+    // Drop the residues below N in the first byte.
+    for (int b = 0; b < 8; ++b) {
+      if (30 * cursor->byte + WHEEL30_RESIDUES[b] < n) {
+        cursor->bits &= ~((uint8_t) 1 << b);
+      }
+    }
+  }
+}
+
+// Return the next prime recorded in SIEVE after the position of
+// CURSOR, advancing CURSOR past it, or -1 if there is none.
+//
+//   CURSOR -- The cursor to advance.
+//
+//   SIEVE -- The WHEEL30_SIEVE_T being enumerated.
+//
+static inline int64_t wheel30_next_prime(wheel30_cursor_t *cursor,
+                                         const wheel30_sieve_t *sieve) {
+  while (0 == cursor->bits) {
+    ++cursor->byte;
+    if (30 * cursor->byte >= sieve->length) {
+      return -1;
+    }
+    cursor->bits = sieve->primes[cursor->byte];
+  }
+  int b = __builtin_ctz(cursor->bits);
+  cursor->bits &= cursor->bits - 1;
+  return 30 * cursor->byte + WHEEL30_RESIDUES[b];
 }
 
 #endif  // INCLUDED_SIEVE_DOT_H
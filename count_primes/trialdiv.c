@@ -22,6 +22,117 @@
 
 #include "./trialdiv.h"
 
+// Bases of the Miller-Rabin test that together admit no strong
+// pseudoprime below 2^64.
+static const uint64_t MILLER_RABIN_BASES[7] = {
+  2, 325, 9375, 28178, 450775, 9780504, 1795265022
+};
+
+// Primes that MILLER_RABIN_PRIME_P() tries as divisors before running
+// the Miller-Rabin test.  Any N below 53^2 with none of them as a
+// divisor is prime.
+static const uint64_t SMALL_DIVISORS[15] = {
+  3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53
+};
+
+// Modulus of Montgomery arithmetic: an odd N < 2^63, together with
+// N_INV = -N^{-1} mod 2^64, R_MOD = 2^64 mod N, and R2_MOD = 2^128 mod
+// N.  A residue A is represented by A * 2^64 mod N.
+typedef struct montgomery_t {
+  uint64_t n;
+  uint64_t n_inv;
+  uint64_t r_mod;
+  uint64_t r2_mod;
+} montgomery_t;
+
+/*************************************************************************
+ * Helper methods
+ *************************************************************************/
+
+// Initialize MONT for the odd modulus N < 2^63.
+//
+//   MONT -- The MONTGOMERY_T to initialize.
+//
+//   N -- The modulus.
+//
+static void montgomery_init(montgomery_t *mont, uint64_t n) {
+  // Each Newton step doubles the number of correct low bits of
+  // N^{-1}, starting from the 3 bits that N itself gets right.
+  uint64_t inv = n;
+  for (int i = 0; i < 5; ++i) {
+    inv *= 2 - n * inv;
+  }
+  mont->n = n;
+  mont->n_inv = -inv;
+  mont->r_mod = -n % n;
+  mont->r2_mod =
+      (uint64_t) (((unsigned __int128) mont->r_mod * mont->r_mod) % n);
+}
+
+// Return T * 2^{-64} mod N for T < N * 2^64.
+//
+//   MONT -- The modulus.
+//
+//   T -- The 128-bit integer to reduce.
+//
+static inline uint64_t montgomery_reduce(const montgomery_t *mont,
+                                         unsigned __int128 t) {
+  // T + M*N is divisible by 2^64, and below 2^128 because N < 2^63.
+  uint64_t m = (uint64_t) t * mont->n_inv;
+  uint64_t u = (uint64_t) ((t + (unsigned __int128) m * mont->n) >> 64);
+  return u >= mont->n ? u - mont->n : u;
+}
+
+// Return the Montgomery product of A and B, both in Montgomery form.
+//
+//   MONT -- The modulus.
+//
+//   A, B -- The factors.
+//
+static inline uint64_t montgomery_multiply(const montgomery_t *mont,
+                                           uint64_t a, uint64_t b) {
+  return montgomery_reduce(mont, (unsigned __int128) a * b);
+}
+
+// Returns whether the odd N > 2 passes the strong probable-prime test
+// to base A, where N - 1 = D * 2^S with D odd.
+//
+//   MONT -- Montgomery arithmetic modulo N.
+//
+//   A -- The base.
+//
+//   D, S -- The decomposition of N - 1.
+//
+static bool strong_probable_prime_p(const montgomery_t *mont, uint64_t a,
+                                    uint64_t d, int s) {
+  uint64_t one = mont->r_mod;
+  uint64_t minus_one = mont->n - one;
+
+  // Compute A^D by left-to-right binary exponentiation.
+  uint64_t base = montgomery_multiply(mont, a, mont->r2_mod);
+  uint64_t x = one;
+  for (int bit = 63 - __builtin_clzll(d); bit >= 0; --bit) {
+    x = montgomery_multiply(mont, x, x);
+    if ((d >> bit) & 1) {
+      x = montgomery_multiply(mont, x, base);
+    }
+  }
+  if (x == one || x == minus_one) {
+    return true;
+  }
+  for (int i = 1; i < s; ++i) {
+    x = montgomery_multiply(mont, x, x);
+    if (x == minus_one) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*************************************************************************
+ * Definitions for methods in header file.
+ *************************************************************************/
+
 bool trialdiv_prime_p(int64_t p) {
   // The smallest prime is 2
   if (p < 2) {
@@ -68,3 +179,54 @@ int64_t trialdiv_count_primes_in_interval(int64_t start, int64_t length) {
   }
   return num_primes;
 }
+
+bool miller_rabin_prime_p(int64_t n) {
+  if (n < 2) {
+    return false;
+  }
+  if (0 == (n & 1)) {
+    return 2 == n;
+  }
+  for (int i = 0; i < 15; ++i) {
+    if (0 == n % SMALL_DIVISORS[i]) {
+      return n == SMALL_DIVISORS[i];
+    }
+  }
+  if (n < 53 * 53) {
+    return true;
+  }
+
+  montgomery_t mont;
+  montgomery_init(&mont, n);
+  uint64_t d = n - 1;
+  int s = __builtin_ctzll(d);
+  d >>= s;
+  for (int i = 0; i < 7; ++i) {
+    uint64_t a = MILLER_RABIN_BASES[i] % n;
+    if (0 != a && !strong_probable_prime_p(&mont, a, d, s)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int64_t miller_rabin_count_primes_in_interval(int64_t start, int64_t length) {
+  // Return 0 primes for nonpositive-length intervals and intervals
+  // whose high endpoint is at most 2.
+  if (length <= 0 || start + length <= 2) {
+    return 0;
+  }
+
+  // Ensure that the smallest value of START is 2.
+  if (start < 2) {
+    length -= 2 - start;
+    start = 2;
+  }
+
+  // Count 2 separately, and test only the odd integers.
+  int64_t num_primes = start <= 2;
+  for (int64_t p = start | 1; p < start + length && p > 0; p += 2) {
+    num_primes += miller_rabin_prime_p(p);
+  }
+  return num_primes;
+}
@@ -20,6 +20,19 @@
  * IN THE SOFTWARE.
  **/
 
+/**************************************************************************
+ * The files TRIALDIV.{H,C} declare and define per-number primality
+ * tests, used to check the results of COUNT_PRIMES_IN_INTERVAL() and
+ * to count the primes of intervals too short to be worth sieving.
+ *
+ * TRIALDIV_PRIME_P() tests P by trial division in O(\sqrt{P}) time.
+ * MILLER_RABIN_PRIME_P() runs the Miller-Rabin test with a fixed set of
+ * seven bases, due to Jim Sinclair, that admits no strong pseudoprime
+ * below 2^64, so the test is deterministic for every int64_t.  Each
+ * base costs one modular exponentiation, carried out in Montgomery
+ * form with 128-bit products, so the test takes O(\log P) time.
+ *************************************************************************/
+
 #ifndef INCLUDED_TRIALDIV_DOT_H
 #define INCLUDED_TRIALDIV_DOT_H
 
@@ -41,4 +54,19 @@ bool trialdiv_prime_p(int64_t p);
 //   LENGTH -- The length of the interval.
 int64_t trialdiv_count_primes_in_interval(int64_t start, int64_t length);
 
+// Use the deterministic Miller-Rabin test to test if N is prime.
+// Returns TRUE if N is prime, FALSE otherwise.
+//
+//   N -- The integer to test for primality.
+//
+bool miller_rabin_prime_p(int64_t n);
+
+// Return the number of primes in [START, START+LENGTH), using the
+// Miller-Rabin test on each integer not divisible by a small prime.
+//
+//   START -- The low endpoint of the interval.
+//
+//   LENGTH -- The length of the interval.
+int64_t miller_rabin_count_primes_in_interval(int64_t start, int64_t length);
+
 #endif  // INCLUDED_TRIALDIV_DOT_H